@@ -5,6 +5,27 @@
 // 2) readHuffTable - reads the huffman table and stores it in an array.
 // 3) readFileInfo - reads the file information and stores it as an array of bits.
 // 4) writeBitString - decodes using the huffman table from readHuffTable and writes the bit string to the file title read in readHeader.
+// 5) decodeHufFile - runs the four steps above over one huf image, which may be a whole file or an archive entry. The
+//    table is checked by validateHuffTable when it is loaded, so writeBitString can walk it without any checks.
+// 6) readArchiveDirectory, listArchive and extractArchive - list and extract the entries of an archive built by huff --archive.
+// 6a) decodeDirectory - decodes every huf file under a directory. Whole files, archive entries and BWT blocks are all
+//    tasks in one work-stealing pool of -j threads.
+// 7) decodeBlockFile - decodes a block format huf file, whose blocks may be coded against a dictionary from huff --train
+//    with the adaptive huffman model from huff --adaptive, with the order-1 context model from huff --order1, or with
+//    the LZ front end from huff --lz, against a reference file given to huff --reference and Puff --reference, or with
+//    the BWT pipeline from huff --bwt, or stored as it is when huff found the data already compressed. Every block is
+//    checked against its CRC32C before it is written, and the whole file against the checksum after the last block.
+//    Blocks added by huff --append follow a BLOCK_APPENDED marker. A huffman block may reuse or patch the table of the
+//    huffman block before it.
+//    Blocks of short codes decode several glyphs per lookup with decodeMultiSymbols unless --single-symbol is given.
+// 8) --test - decodes through discardBuffer instead of a file, checking the block checksums and that every block and
+//    file decodes to the number of bytes stored for it, then reports the decode throughput. Nothing is written.
+// 9) serveRequests - with --serve, decodes huf images sent over a UNIX domain socket by a pool of warm workers, using the
+//    request format of huff --serve, and keeps request latency histograms.
+// 10) decodeStream - an incremental decoder fed a block format image in chunks split anywhere and drained of output a
+//    block at a time, the counterpart of huff's CompressionStream. blockReader pulls through it from an istream and hands
+//    out the data in caller sized chunks or through an input iterator, for consumers that process the data as it is
+//    decoded. --cat writes a file to standard output through it.
 // Name: Taylor Barber
 // Date: 11/3/2019
 #include <iostream>
@@ -13,12 +34,133 @@
 #include <iomanip>
 #include <sstream>
 #include <ctime>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <filesystem>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <random>
+#include <cerrno>
+#include <iterator>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PUFF_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PUFF_TARGET_SSE42
+#else
+#include <cpuid.h>
+#define PUFF_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+// The BMI2 decoder is the portable one compiled again with BMI2 enabled. MSVC has no per function targets, so it uses the
+// shift intrinsics instead.
+#if defined(_M_X64) || defined(__x86_64__)
+#define PUFF_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define PUFF_TARGET_BMI2
+#else
+#define PUFF_TARGET_BMI2 __attribute__((target("bmi2"), flatten))
+#endif
+#endif
 using namespace std;
 
 const int huffEntrySize = 12;
 const int ENDOFFILE = 256;
 const int BYTESIZE = 8;
 
+// "HPAR" when read as bytes
+const int ARCHIVE_MAGIC = 0x52415048;
+const int archiveFooterSize = sizeof(long long) + 2 * sizeof(int);
+
+// "HPF2" when read as bytes, marks a huf file made of blocks
+const int BLOCK_FILE_MAGIC = 0x32465048;
+const int BLOCK_END = 0;
+const int BLOCK_DICTIONARY = 1;
+const int BLOCK_ADAPTIVE = 2;
+const int BLOCK_ORDER1 = 3;
+const int BLOCK_LZ = 4;
+const int BLOCK_BWT = 5;
+const int BLOCK_HUFFMAN = 6;
+const int BLOCK_STORED = 7;
+// Left by huff --append where an end block was, followed by that end block's stale file checksum.
+const int BLOCK_APPENDED = 8;
+// An LZ block coded against a reference file, whose CRC32C and length start the payload.
+const int BLOCK_DELTA = 9;
+// Huffman blocks coded with the previous huffman block's table, as it is or with the code lengths in the payload changed.
+const int BLOCK_HUFFMAN_REUSE = 10;
+const int BLOCK_HUFFMAN_PATCH = 11;
+
+// Block checksums are CRC32C, computed with the SSE4.2 instruction when the processor has it
+const unsigned int CRCPOLYNOMIAL = 0x82F63B78u;
+const unsigned int CRCINITIAL = 0xFFFFFFFFu;
+const int CRCSLICES = 8;
+
+// Decoder kernels. The best one the processor supports is used unless --kernel forces another.
+const int KERNELPORTABLE = 0;
+const int KERNELBMI2 = 1;
+const int KERNELCOUNT = 2;
+const char* const KERNELNAMES[KERNELCOUNT] = { "portable", "bmi2" };
+
+// "HPDC" when read as bytes
+const int DICTIONARY_MAGIC = 0x43445048;
+const int MAXGLYPHS = 257;
+const int MAXCODELENGTH = 64;
+
+// Multi-symbol tables resolve up to MULTIGLYPHS codes from one MULTITABLEBITS bit lookup. They are only built when the
+// block is long enough to pay for the table and the code lengths imply a mean of at most MULTIMAXMEANLENGTH bits, so
+// that most lookups hold two codes or more.
+const int MULTITABLEBITS = 12;
+const int MULTIGLYPHS = 4;
+const int MULTIMINSYMBOLS = 16 * 1024;
+const double MULTIMAXMEANLENGTH = 6.0;
+
+// Adaptive blocks code the 256 byte glyphs, so the tree has at most 513 nodes with the root numbered highest
+const int ADAPTIVEGLYPHS = 256;
+const int ADAPTIVENODES = 2 * ADAPTIVEGLYPHS + 1;
+const int ADAPTIVEROOT = ADAPTIVENODES - 1;
+const int ADAPTIVERESETWEIGHT = 1 << 24;
+
+// Order-1 blocks pick a table by the previous byte and store each table as a bitmap of used glyphs and 4 bit lengths
+const int ORDER1CONTEXTS = 256;
+
+// Each order-1 table is decoded through a lookup table of ORDER1TABLEBITS bits, kept small because the previous byte
+// switches tables on every glyph
+const int ORDER1TABLEBITS = 10;
+const int BYTEGLYPHS = 256;
+
+// LZ blocks code a match as glyph 256 of the literal table followed by a length code and a distance code
+const int LZMATCHGLYPH = 256;
+const int LZMINMATCH = 3;
+const int LZLENGTHCODES = 16;
+const int LZDISTANCECODES = 44;
+
+// BWT blocks code runs of move-to-front zeros as RUNA and RUNB in bijective base 2 and other indices moved up by one
+const int BWTRUNA = 0;
+const int BWTRUNB = 1;
+
+// --cat hands blockReader a buffer this size, small enough to stay in cache
+const int CATCHUNKSIZE = 64 * 1024;
+
 // Struct to contain the data stored in a entry in the huffman table.
 struct huffEntry
 {
@@ -27,12 +169,617 @@ struct huffEntry
 	int rightPointer;
 };
 
+// Struct to contain a shared table trained by huff --train, rebuilt as a huffman tree from its code lengths.
+struct huffDictionary
+{
+	int id;
+	unsigned char codeLengths[MAXGLYPHS];
+	vector<huffEntry> huffTree;
+};
+
+// Dictionaries loaded with --dictionary. They are only read once decoding starts, so archive workers can share them.
+vector<huffDictionary> dictionaries;
+
+// Struct to contain an earlier revision loaded with --reference, which delta blocks are decoded against.
+struct referenceFile
+{
+	unsigned int checksum;
+	string data;
+};
+
+// References loaded with --reference, shared by every worker like the dictionaries.
+vector<referenceFile> references;
+
+// Requests to --serve are an int type and an int length followed by that many bytes, and responses an int status and
+// an int length followed by the decoded data, the stats or an error message, the same as huff --serve.
+const int REQUEST_COMPRESS = 1;
+const int REQUEST_DECOMPRESS = 2;
+const int REQUEST_STATS = 3;
+const int REQUEST_TYPES = 4;
+const char* const REQUEST_NAMES[REQUEST_TYPES] = { "unknown", "compress", "decompress", "stats" };
+const int RESPONSE_OK = 0;
+const int RESPONSE_ERROR = 1;
+const int MAXREQUESTLENGTH = 256 * 1024 * 1024;
+
+// Bucket i counts the requests that took less than 2^i microseconds.
+const int LATENCYBUCKETS = 32;
+
+// Struct to contain the latency histogram of one request type.
+struct latencyHistogram
+{
+	atomic<long long> buckets[LATENCYBUCKETS];
+	atomic<long long> requests;
+	atomic<long long> totalMicroseconds;
+};
+
+// Struct to contain a streambuf that reads a request in place, so the image is not copied into a stringstream.
+struct memoryBuffer : public streambuf
+{
+	memoryBuffer(char* data, size_t length)
+	{
+		setg(data, data, data + length);
+	}
+};
+
+// Struct to contain a streambuf that appends to a vector it does not own, so each worker's response buffer keeps its
+// capacity from one request to the next.
+struct vectorBuffer : public streambuf
+{
+	vector<char>* bytes;
+
+	explicit vectorBuffer(vector<char>* output) : bytes(output) {}
+
+	int overflow(int character) override
+	{
+		if (character != traits_type::eof())
+			bytes->push_back((char)character);
+
+		return traits_type::not_eof(character);
+	}
+
+	streamsize xsputn(const char* data, streamsize count) override
+	{
+		bytes->insert(bytes->end(), data, data + count);
+		return count;
+	}
+};
+
+// Struct to contain a node of the adaptive huffman tree. Node numbers are array indices and weights never decrease as
+// the number increases.
+struct adaptiveNode
+{
+	int glyph;
+	int weight;
+	int parent;
+	int leftPointer;
+	int rightPointer;
+};
+
+// Struct to contain the adaptive huffman tree shared by every adaptive block of a file.
+struct adaptiveTree
+{
+	adaptiveNode nodes[ADAPTIVENODES];
+	int leaves[ADAPTIVEGLYPHS];
+	int notYetTransmitted;
+};
+
+// Struct to contain the position of the next bit to read from a block's data.
+struct bitReader
+{
+	const unsigned char* data;
+	int bitSize;
+	int position;
+};
+
+// Slicing-by-8 tables for the software CRC32C, filled by initializeCrc.
+unsigned int crcTable[CRCSLICES][BYTEGLYPHS];
+bool hardwareCrc = false;
+
+// Filled by detectCpuFeatures.
+bool cpuHasBmi2 = false;
+int decoderKernel = KERNELPORTABLE;
+
+// Cleared by --single-symbol to compare against the one code per lookup decoders.
+bool multiSymbolTables = true;
+
+// Set by --test. Decoded bytes are counted and thrown away instead of written.
+bool testOnly = false;
+atomic<long long> testedBytes{ 0 };
+
+// Struct to contain the output sink for --test. It counts the bytes written to it and keeps none of them.
+struct discardBuffer : public streambuf
+{
+	long long byteCount = 0;
+
+	int overflow(int character) override
+	{
+		byteCount++;
+		return traits_type::not_eof(character);
+	}
+
+	streamsize xsputn(const char*, streamsize count) override
+	{
+		byteCount += count;
+		return count;
+	}
+};
+
+// Shifts used by the portable table decoder.
+struct portableBitOps
+{
+	static unsigned long long shiftLeft(unsigned long long value, int count)
+	{
+		return value << count;
+	}
+
+	static unsigned long long shiftRight(unsigned long long value, int count)
+	{
+		return value >> count;
+	}
+};
+
+// Shifts used by the BMI2 table decoder.
+#if defined(PUFF_X64) && defined(_MSC_VER)
+struct bmi2BitOps
+{
+	static unsigned long long shiftLeft(unsigned long long value, int count)
+	{
+		return _shlx_u64(value, count);
+	}
+
+	static unsigned long long shiftRight(unsigned long long value, int count)
+	{
+		return _shrx_u64(value, count);
+	}
+};
+#else
+struct bmi2BitOps : portableBitOps {};
+#endif
+
+// Struct to contain a block read ahead so that several BWT blocks can be decoded at once.
+struct pendingBlock
+{
+	int rawLength;
+	unsigned int checksum;
+	vector<unsigned char> payload;
+	string output;
+	bool decoded;
+};
+
+// Struct to contain a block read by --fuzz, with the size of the table at the start of its payload and the code lengths of
+// the huffman table it starts from.
+struct fuzzBlock
+{
+	int blockType;
+	int rawLength;
+	int tableSize;
+	vector<unsigned char> payload;
+	vector<unsigned char> previousLengths;
+};
+
+// Struct to contain what a block of a block format file leaves for the blocks after it: the adaptive model, which
+// carries on from block to block, and the last huffman table, which later huffman blocks may reuse or patch.
+struct blockContext
+{
+	string fileName;
+	adaptiveTree* tree = nullptr;
+	unsigned char huffmanLengths[MAXGLYPHS] = { 0 };
+	vector<huffEntry> huffmanTree;
+
+	blockContext() = default;
+	blockContext(const blockContext&) = delete;
+
+	~blockContext()
+	{
+		delete tree;
+	}
+};
+
+// Struct to contain the state of an incremental decoder for a block format huf image, the counterpart of huff's
+// CompressionStream. Input is fed in chunks split anywhere, and a block is decoded once all of it has arrived and its
+// output is wanted, so output holds at most one block. Each block is checked before any of it is drained. finished is
+// set once the file checksum has been read, and failed if anything does not check out, after which nothing more is
+// decoded.
+struct decodeStream
+{
+	blockContext context;
+	vector<unsigned char> input;
+	size_t inputPosition = 0;
+	string output;
+	size_t outputPosition = 0;
+	bool headerRead = false;
+	unsigned int fileCrc = CRCINITIAL;
+	int blockNumber = 0;
+	bool finished = false;
+	bool failed = false;
+};
+
+// Struct to contain a pull decoder over a block format huf image, for callers that process the data while it is
+// decoded rather than reading back a finished file. It feeds a decodeStream from the istream a chunk at a time as read
+// or the iterator needs more, so only one block of output is ever held and a caller reading in small chunks keeps its
+// buffer in cache. stream.failed is set if the image is damaged or cut short, and the data stops there.
+struct blockReader
+{
+	istream& fin;
+	decodeStream stream;
+	vector<char> chunk;
+
+	// An input iterator over the decoded bytes, which equals end() once they run out
+	struct iterator
+	{
+		using iterator_category = input_iterator_tag;
+		using value_type = char;
+		using difference_type = ptrdiff_t;
+		using pointer = const char*;
+		using reference = const char&;
+
+		// What *iterator++ reads, since the byte may be in a block that has been replaced by then
+		struct previousByte
+		{
+			char byte;
+
+			char operator*() const
+			{
+				return byte;
+			}
+		};
+
+		blockReader* reader;
+
+		reference operator*() const
+		{
+			return reader->stream.output[reader->stream.outputPosition];
+		}
+
+		iterator& operator++();
+
+		previousByte operator++(int)
+		{
+			previousByte previous{ **this };
+			++*this;
+			return previous;
+		}
+
+		bool operator==(const iterator& other) const
+		{
+			return reader == other.reader;
+		}
+
+		bool operator!=(const iterator& other) const
+		{
+			return reader != other.reader;
+		}
+	};
+
+	explicit blockReader(istream& input);
+
+	bool nextBlock();
+	size_t read(char* buffer, size_t size);
+	iterator begin();
+	iterator end();
+};
+
+// Struct to contain one entry of a table decoder's lookup table. length is the code length of symbol, or 0 when the
+// code is longer than the table and symbol is the compact tree node to carry on from.
+struct tableEntry
+{
+	unsigned short symbol;
+	unsigned char length;
+};
+
+// Struct to contain a node of the compact tree that finishes codes longer than a lookup table. The nodes are numbered in
+// breadth first order from the nodes the table reaches, so a walk stays in a few cache lines, and a child with
+// COMPACTLEAF set is the glyph in its low bits rather than another node.
+struct compactNode
+{
+	unsigned short children[2];
+};
+
+const unsigned short COMPACTLEAF = 0x8000;
+
+// Struct to contain one entry of a multi-symbol lookup table: the count glyphs whose codes fit one after another in the
+// table's bits, and the length of those codes together. A count of 0 means the first code does not fit.
+struct multiTableEntry
+{
+	unsigned char glyphs[MULTIGLYPHS];
+	unsigned char count;
+	unsigned char length;
+};
+
+// Struct to contain one worker's tasks. The owner takes the newest task from the back and idle workers steal the oldest
+// from the front.
+struct taskQueue
+{
+	mutex lock;
+	deque<function<void()>> tasks;
+};
+
+// Struct to contain the work-stealing pool shared by files, archive entries and blocks. The last queue takes tasks
+// submitted from outside the pool.
+struct workStealingPool
+{
+	vector<taskQueue> queues;
+	vector<thread> workers;
+	atomic<int> queuedTasks{ 0 };
+	atomic<bool> stopping{ false };
+	mutex sleepLock;
+	condition_variable wakeUp;
+};
+
+workStealingPool taskPool;
+
+// The queue owned by the current thread, or -1 outside the pool's workers.
+thread_local int workerIndex = -1;
+
+// Struct to contain one entry of an archive's central directory.
+struct archiveEntry
+{
+	string name;
+	int originalSize;
+	int compressedSize;
+	long long offset;
+};
+
+// Function Name: detectCpuFeatures
+// Description: This function uses cpuid to check whether the processor has the SSE4.2 CRC32 instruction and BMI2, and
+// picks the decoder kernel.
+void detectCpuFeatures()
+{
+#if defined(PUFF_X86) && defined(_MSC_VER)
+	int cpuInfo[4];
+	__cpuid(cpuInfo, 0);
+	int maxLeaf = cpuInfo[0];
+
+	__cpuid(cpuInfo, 1);
+	hardwareCrc = (cpuInfo[2] >> 20) & 1;
+
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(cpuInfo, 7, 0);
+		cpuHasBmi2 = (cpuInfo[1] >> 8) & 1;
+	}
+#elif defined(PUFF_X86)
+	unsigned int eax, ebx, ecx, edx;
+	hardwareCrc = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 20) & 1);
+	cpuHasBmi2 = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && ((ebx >> 8) & 1);
+#endif
+
+#ifdef PUFF_X64
+	if (cpuHasBmi2)
+		decoderKernel = KERNELBMI2;
+#else
+	cpuHasBmi2 = false;
+#endif
+}
+
+// Function Name: initializeCrc
+// Description: This function fills the software CRC32C tables.
+void initializeCrc()
+{
+	for (int i = 0; i < BYTEGLYPHS; i++)
+	{
+		unsigned int crc = i;
+
+		for (int bit = 0; bit < BYTESIZE; bit++)
+			crc = (crc >> 1) ^ (CRCPOLYNOMIAL & (0u - (crc & 1)));
+
+		crcTable[0][i] = crc;
+	}
+
+	for (int slice = 1; slice < CRCSLICES; slice++)
+		for (int i = 0; i < BYTEGLYPHS; i++)
+			crcTable[slice][i] = (crcTable[slice - 1][i] >> 8) ^ crcTable[0][crcTable[slice - 1][i] & 0xFF];
+}
+
+#ifdef PUFF_X86
+// Function Name: updateCrcHardware
+// Description: This function adds data to a running CRC32C with the SSE4.2 CRC32 instruction, eight bytes at a time on
+// 64 bit builds.
+PUFF_TARGET_SSE42 unsigned int updateCrcHardware(unsigned int crc, const unsigned char* data, size_t dataLength)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned long long wideCrc = crc;
+
+	for (; dataLength >= sizeof(long long); data += sizeof(long long), dataLength -= sizeof(long long))
+	{
+		unsigned long long word;
+		memcpy(&word, data, sizeof(long long));
+		wideCrc = _mm_crc32_u64(wideCrc, word);
+	}
+
+	crc = (unsigned int)wideCrc;
+#endif
+
+	while (dataLength-- > 0)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+#endif
+
+// Function Name: updateCrc
+// Description: This function adds data to a running CRC32C, with the hardware instruction when it is available and the
+// slicing tables otherwise. A checksum starts from CRCINITIAL and is inverted once all the data has been added.
+unsigned int updateCrc(unsigned int crc, const void* data, size_t dataLength)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+
+#ifdef PUFF_X86
+	if (hardwareCrc)
+		return updateCrcHardware(crc, bytes, dataLength);
+#endif
+
+	for (; dataLength >= CRCSLICES; bytes += CRCSLICES, dataLength -= CRCSLICES)
+	{
+		unsigned int low;
+		unsigned int high;
+
+		memcpy(&low, bytes, sizeof(int));
+		memcpy(&high, bytes + sizeof(int), sizeof(int));
+		low ^= crc;
+
+		crc = crcTable[7][low & 0xFF] ^ crcTable[6][(low >> 8) & 0xFF] ^ crcTable[5][(low >> 16) & 0xFF] ^ crcTable[4][low >> 24]
+			^ crcTable[3][high & 0xFF] ^ crcTable[2][(high >> 8) & 0xFF] ^ crcTable[1][(high >> 16) & 0xFF] ^ crcTable[0][high >> 24];
+	}
+
+	while (dataLength-- > 0)
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *bytes++) & 0xFF];
+
+	return crc;
+}
+
+// Function Name: runPoolTask
+// Description: This function runs one task from the pool, the newest from the calling thread's own queue or else the
+// oldest stolen from another queue. Returns false if every queue was empty.
+bool runPoolTask()
+{
+	const int queueCount = (int)taskPool.queues.size();
+	const int ownQueue = workerIndex >= 0 ? workerIndex : queueCount - 1;
+
+	for (int i = 0; i < queueCount; i++)
+	{
+		taskQueue& queue = taskPool.queues[(ownQueue + i) % queueCount];
+		function<void()> task;
+
+		{
+			lock_guard<mutex> guard(queue.lock);
+
+			if (queue.tasks.empty())
+				continue;
+
+			if (i == 0)
+			{
+				task = move(queue.tasks.back());
+				queue.tasks.pop_back();
+			}
+
+			else
+			{
+				task = move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+		}
+
+		taskPool.queuedTasks--;
+		task();
+
+		return true;
+	}
+
+	return false;
+}
+
+// Function Name: submitPoolTask
+// Description: This function adds a task to the calling thread's queue and wakes a sleeping worker.
+void submitPoolTask(function<void()> task)
+{
+	const int queueCount = (int)taskPool.queues.size();
+	taskQueue& queue = taskPool.queues[workerIndex >= 0 ? workerIndex : queueCount - 1];
+
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.tasks.push_back(move(task));
+	}
+
+	taskPool.queuedTasks++;
+
+	{
+		lock_guard<mutex> guard(taskPool.sleepLock);
+	}
+
+	taskPool.wakeUp.notify_one();
+}
+
+// Function Name: waitForPoolTasks
+// Description: This function runs pool tasks until remainingTasks reaches zero, so a task can wait for the tasks it
+// submitted without tying up a worker.
+void waitForPoolTasks(atomic<int>& remainingTasks)
+{
+	while (remainingTasks > 0)
+	{
+		if (!runPoolTask())
+			this_thread::yield();
+	}
+}
+
+// Function Name: startTaskPool
+// Description: This function starts threadCount - 1 workers. The main thread works whenever it waits, so it makes up the
+// last thread.
+void startTaskPool(int threadCount)
+{
+	int workerCount = max(0, threadCount - 1);
+
+	taskPool.queues = vector<taskQueue>(workerCount + 1);
+
+	for (int i = 0; i < workerCount; i++)
+	{
+		taskPool.workers.emplace_back([i]()
+		{
+			workerIndex = i;
+
+			while (!taskPool.stopping)
+			{
+				if (!runPoolTask())
+				{
+					unique_lock<mutex> sleep(taskPool.sleepLock);
+					taskPool.wakeUp.wait(sleep, []() { return taskPool.queuedTasks > 0 || taskPool.stopping; });
+				}
+			}
+		});
+	}
+}
+
+// Function Name: stopTaskPool
+// Description: This function stops the pool's workers. It is registered with atexit so every way out of main stops them.
+void stopTaskPool()
+{
+	{
+		lock_guard<mutex> guard(taskPool.sleepLock);
+		taskPool.stopping = true;
+	}
+
+	taskPool.wakeUp.notify_all();
+
+	for (int i = 0; i < (int)taskPool.workers.size(); i++)
+		taskPool.workers[i].join();
+
+	taskPool.workers.clear();
+}
+
+// Function Name: openOutputFile
+// Description: This function opens the file a huf image decodes to, creating the directories in its name first so that
+// a tree compressed by huff comes back with the same layout. The name comes from the image, so a name with a root or a
+// ".." component is refused and fout is left failed, and a damaged or crafted file can only write below the current
+// directory.
+void openOutputFile(const string& fileName, ofstream& fout)
+{
+	error_code error;
+	filesystem::path path(fileName);
+	filesystem::path parent = path.parent_path();
+
+	bool outside = path.empty() || path.has_root_path();
+	for (const filesystem::path& component : path)
+		outside = outside || component == "..";
+
+	if (outside)
+	{
+		cerr << fileName << " is not a name below the current directory, not writing it" << endl;
+		fout.setstate(ios::failbit);
+		return;
+	}
+
+	if (!parent.empty())
+		filesystem::create_directories(parent, error);
+
+	fout.open(fileName, ios::binary | ios::out);
+}
+
 // Function Name: readFileInfo
 // Description: This function accepts an fstream object connected to a huf file, the data size of the huffman table
 // stored in the huf file, the huffman table from the huf file, and an empty bit string to store the bit values
 // Using these input values, the function loops through each byte to find its value in binary using reverse byte architecture.
 // During the looping process, the bit is stored in the bit string for later use.
-void readFileInfo(ifstream& fin, int huffDataSize, huffEntry* huffTree, int* bitString)
+void readFileInfo(istream& fin, int huffDataSize, huffEntry*, int* bitString)
 {
 
 	unsigned char* fileData = new unsigned char[huffDataSize];
@@ -57,18 +804,15 @@ void readFileInfo(ifstream& fin, int huffDataSize, huffEntry* huffTree, int* bit
 			huffDataBitCounter++;
 		}
 	}
-	delete[huffDataSize] fileData;
+	delete[] fileData;
 }
 
 // Function Name: readHuffTable
 // Description: This function will have inputs of an ifstream object that is linked to a huf file, the number of huffman table entries there
 // are in the file, and an emty array to store the huffman table read from the file. It will loop through the entries storing them
 // in an array of huffEntries (struct at top of page) that has a glyph, left pointer, and right pointer.
-void readHuffTable(ifstream& fin, int huffTableEntries, huffEntry* huffTree)
+void readHuffTable(istream& fin, int huffTableEntries, huffEntry* huffTree)
 {
-	int getPointerLocation;
-
-	int j = 0;
 	for (int i = 0; i < huffTableEntries; i++)
 	{
 		fin.read((char*)&huffTree[i].glyph, sizeof(int));
@@ -79,114 +823,2644 @@ void readHuffTable(ifstream& fin, int huffTableEntries, huffEntry* huffTree)
 
 // Function Name: readHeader
 // Description: This method reads the file name, and the huffman table entry amount.
-void readHeader(ifstream& fin, int& HuffTableEntries, int& fileNameLength, unsigned char* compressedFile)
+void readHeader(istream& fin, int& HuffTableEntries, int& fileNameLength, unsigned char* compressedFile)
 {
 	fin.read((char*)compressedFile, fileNameLength);
 	fin.read((char*)&HuffTableEntries, sizeof(int));
 
-	compressedFile[fileNameLength] = NULL;
+	compressedFile[fileNameLength] = '\0';
 }
 
-// Function Name: writeBitString
-// Description: This method accepts an ofstream object, the huffman table created in readHuffTable, the bit string from
-// readFileInfo, and the file data's bit size. It will then loop through the huffman tablecomparing each bit from
-// the bit string in order to find a leaf node. It will also print each glyph on the leaf nodes found using the bitcodes
-// to the fout object. If it reaches an end of file glyph, the function is terminated.
-void writeBitString(ofstream& fout, huffEntry* huffTree, int* bitString, int huffDataBitSize)
+// Function Name: validateHuffTable
+// Description: This function checks a huffman table read by readHuffTable before anything is decoded with it. Every
+// node reached from the root must either be a leaf holding a glyph up to the end of file glyph, or have two children
+// that are in range and not reached any other way. That rules out cycles and shared nodes, and means every bit string
+// leads to a leaf, so the table is a complete prefix code. Returns false if the table fails any check.
+bool validateHuffTable(const huffEntry* huffTree, int huffTableEntries)
 {
-	int nodePosition = 0;
+	if (huffTableEntries < 1)
+		return false;
 
-	for (int i = 0; i < huffDataBitSize; i++)
+	vector<bool> reached(huffTableEntries, false);
+	vector<int> pending(1, 0);
+	reached[0] = true;
+
+	while (!pending.empty())
 	{
-		if (huffTree[nodePosition].glyph == ENDOFFILE)
-		{
-			return;
-		}
+		const huffEntry& entry = huffTree[pending.back()];
+		pending.pop_back();
 
-		if (bitString[i] == 1 && huffTree[nodePosition].rightPointer != -1)
+		if (entry.leftPointer == -1 && entry.rightPointer == -1)
 		{
-			nodePosition = huffTree[nodePosition].rightPointer;
-		}
+			if (entry.glyph < 0 || entry.glyph > ENDOFFILE)
+				return false;
 
-		else if (bitString[i] == 0 && huffTree[nodePosition].leftPointer != -1)
-		{
-			nodePosition = huffTree[nodePosition].leftPointer;
+			continue;
 		}
 
-		else
+		int children[2] = { entry.leftPointer, entry.rightPointer };
+
+		for (int c = 0; c < 2; c++)
 		{
-			fout << (char)huffTree[nodePosition].glyph;
-			nodePosition = 0;
-			i--;
+			// The root can never be a child, so pointing at it is always a cycle
+			if (children[c] < 1 || children[c] >= huffTableEntries || reached[children[c]])
+				return false;
+
+			reached[children[c]] = true;
+			pending.push_back(children[c]);
 		}
 	}
+
+	return true;
 }
 
-int main()
+// Function Name: loadHuffTable
+// Description: This function reads the header and huffman table of a single table huf image, after the file name length
+// has been read, and fills in the file name, the table and the size of the data that follows. The name length and table
+// size are checked against the image size before anything is allocated, and the table with validateHuffTable.
+// Returns false if any check fails.
+bool loadHuffTable(istream& fin, int huffFileSize, int fileNameLength, string& fileName, vector<huffEntry>& huffTree, int& huffDataSize)
 {
+	if (fileNameLength < 0 || fileNameLength > huffFileSize - BYTESIZE)
+		return false;
 
 	int huffTableEntries = 0;
-	int huffTableByteSize = 0;
+	unsigned char* compressedFile = new unsigned char[fileNameLength + 1];
+
+	readHeader(fin, huffTableEntries, fileNameLength, compressedFile);
+	fileName = string(reinterpret_cast<char*>(compressedFile), fileNameLength);
+	delete[] compressedFile;
+
+	// A tree over MAXGLYPHS glyphs never needs more than 2 * MAXGLYPHS - 1 entries
+	if (!fin || huffTableEntries < 1 || huffTableEntries > 2 * MAXGLYPHS - 1)
+		return false;
+
+	huffDataSize = huffFileSize - (huffTableEntries * huffEntrySize + fileNameLength + BYTESIZE);
+
+	if (huffDataSize < 0)
+		return false;
+
+	huffTree.resize(huffTableEntries);
+	readHuffTable(fin, huffTableEntries, huffTree.data());
+
+	return fin && validateHuffTable(huffTree.data(), huffTableEntries);
+}
+
+// Function Name: writeBitString
+// Description: This method accepts an ofstream object, the huffman table created in readHuffTable, the bit string from
+// readFileInfo, and the file data's bit size. It will then loop through the huffman table comparing each bit from
+// the bit string in order to find a leaf node. It will also print each glyph on the leaf nodes found using the bitcodes
+// to the fout object. If it reaches an end of file glyph, the function is terminated. The table must have passed
+// validateHuffTable, so every node has no children or two children that are in range and the loop needs no checks.
+// Returns false if the bits ran out before the end of file glyph.
+bool writeBitString(ostream& fout, huffEntry* huffTree, int* bitString, int huffDataBitSize)
+{
+	int nodePosition = 0;
+
+	// A root with no children has no code to read, which is how an empty file is stored
+	if (huffTree[0].leftPointer == -1)
+		return true;
+
+	for (int i = 0; i < huffDataBitSize; i++)
+	{
+		if (bitString[i] == 1)
+			nodePosition = huffTree[nodePosition].rightPointer;
+		else
+			nodePosition = huffTree[nodePosition].leftPointer;
+
+		if (huffTree[nodePosition].leftPointer == -1)
+		{
+			if (huffTree[nodePosition].glyph == ENDOFFILE)
+				return true;
+
+			fout << (char)huffTree[nodePosition].glyph;
+			nodePosition = 0;
+		}
+	}
+
+	return false;
+}
+
+// Function Name: buildTreeFromCodeLengths
+// Description: This function accepts the code length of every glyph and builds the huffman tree for the canonical codes
+// they describe, in the same huffEntry layout readHuffTable produces. Codes are assigned in order of length and then glyph,
+// matching generateCanonicalBitcodes in huff. The lengths are checked while the tree is built, so the decoders can walk
+// it without checks. Returns false if the lengths do not describe a complete prefix code.
+bool buildTreeFromCodeLengths(const unsigned char* codeLengths, vector<huffEntry>& huffTree)
+{
+	unsigned long long code = 0;
+	int previousLength = 0;
+	int codeCount = 0;
+
+	huffTree.assign(1, huffEntry{ -1, -1, -1 });
+
+	for (int length = 1; length <= MAXCODELENGTH; length++)
+	{
+		for (int glyph = 0; glyph < MAXGLYPHS; glyph++)
+		{
+			if (codeLengths[glyph] != length)
+				continue;
+
+			code <<= length - previousLength;
+			previousLength = length;
+
+			// Too many short codes leave no room for this one
+			if (length < MAXCODELENGTH && (code >> length) != 0)
+				return false;
+
+			int nodePosition = 0;
+			for (int bit = length - 1; bit >= 0; bit--)
+			{
+				bool right = (code >> bit) & 1;
+				int pointer = right ? huffTree[nodePosition].rightPointer : huffTree[nodePosition].leftPointer;
+
+				if (huffTree[nodePosition].glyph != -1)
+					return false;
+
+				if (pointer == -1)
+				{
+					pointer = (int)huffTree.size();
+					huffTree.push_back(huffEntry{ -1, -1, -1 });
+
+					if (right)
+						huffTree[nodePosition].rightPointer = pointer;
+					else
+						huffTree[nodePosition].leftPointer = pointer;
+				}
+
+				nodePosition = pointer;
+			}
+
+			if (huffTree[nodePosition].glyph != -1 || huffTree[nodePosition].leftPointer != -1 || huffTree[nodePosition].rightPointer != -1)
+				return false;
+
+			huffTree[nodePosition].glyph = glyph;
+			codeCount++;
+			code++;
+		}
+	}
+
+	// huff gives a lone glyph a 1 bit code, so either bit decodes to it. A table with no codes loops on the root, which
+	// reads through the data without producing a glyph.
+	if (codeCount == 0)
+	{
+		huffTree[0].leftPointer = 0;
+		huffTree[0].rightPointer = 0;
+		return true;
+	}
+
+	// A lone code of any other length leaves interior nodes with one child, which the decoders would follow off the tree
+	if (codeCount == 1)
+	{
+		int leaf = huffTree[0].leftPointer;
+		if (leaf == -1 || huffTree[leaf].glyph == -1 || huffTree[leaf].leftPointer != -1 || huffTree[leaf].rightPointer != -1)
+			return false;
+
+		huffTree[0].rightPointer = huffTree[0].leftPointer;
+		return true;
+	}
+
+	for (int i = 0; i < (int)huffTree.size(); i++)
+		if ((huffTree[i].leftPointer == -1) != (huffTree[i].rightPointer == -1))
+			return false;
+
+	return true;
+}
+
+// Function Name: fillDecodeTable
+// Description: This function fills the lookup table of a table decoder from a tree built by buildTreeFromCodeLengths.
+// The table is indexed by the next tableBits bits of data, first bit lowest. A code of depth bits fills every entry whose
+// low bits match it, and a path still inside the tree after tableBits bits leaves the node it reached with a length of 0.
+void fillDecodeTable(const vector<huffEntry>& huffTree, int nodePosition, int depth, int bits, int tableBits, tableEntry* table)
+{
+	const huffEntry& node = huffTree[nodePosition];
+
+	if (node.leftPointer == -1)
+	{
+		for (int index = bits; index < (1 << tableBits); index += 1 << depth)
+			table[index] = tableEntry{ (unsigned short)node.glyph, (unsigned char)depth };
+
+		return;
+	}
+
+	if (depth == tableBits)
+	{
+		table[bits] = tableEntry{ (unsigned short)nodePosition, 0 };
+		return;
+	}
+
+	fillDecodeTable(huffTree, node.leftPointer, depth + 1, bits, tableBits, table);
+	fillDecodeTable(huffTree, node.rightPointer, depth + 1, bits | (1 << depth), tableBits, table);
+}
+
+// Function Name: buildCompactTree
+// Description: This function builds the compact tree for the entries of a lookup table whose codes are longer than the
+// table, which fillDecodeTable leaves holding huffTree nodes, and points those entries at compact nodes instead. Only the
+// subtrees below the table are copied, in breadth first order.
+void buildCompactTree(const vector<huffEntry>& huffTree, tableEntry* table, int tableSize, vector<compactNode>& nodes)
+{
+	vector<int> compactIndex(huffTree.size(), -1);
+	vector<int> order;
+
+	nodes.clear();
+
+	for (int index = 0; index < tableSize; index++)
+	{
+		if (table[index].length != 0)
+			continue;
+
+		int nodePosition = table[index].symbol;
+
+		if (compactIndex[nodePosition] == -1)
+		{
+			compactIndex[nodePosition] = (int)order.size();
+			order.push_back(nodePosition);
+		}
+
+		table[index].symbol = (unsigned short)compactIndex[nodePosition];
+	}
+
+	// order grows as the walk finds internal children, so this is a breadth first numbering
+	for (int i = 0; i < (int)order.size(); i++)
+	{
+		const huffEntry& node = huffTree[order[i]];
+		compactNode compact;
+		int children[2] = { node.leftPointer, node.rightPointer };
+
+		for (int side = 0; side < 2; side++)
+		{
+			const huffEntry& child = huffTree[children[side]];
+
+			if (child.leftPointer == -1)
+				compact.children[side] = (unsigned short)(COMPACTLEAF | child.glyph);
+
+			else
+			{
+				if (compactIndex[children[side]] == -1)
+				{
+					compactIndex[children[side]] = (int)order.size();
+					order.push_back(children[side]);
+				}
+
+				compact.children[side] = (unsigned short)compactIndex[children[side]];
+			}
+		}
+
+		nodes.push_back(compact);
+	}
+}
+
+// Function Name: decodeLongCode
+// Description: This function finishes a code longer than a lookup table of tableBits bits by walking the compact tree
+// from the node the table reached, refilling the bit buffer a byte at a time when it runs low. Returns the glyph, which
+// is only valid if bitCount is still at least 0 afterwards.
+inline int decodeLongCode(const vector<compactNode>& nodes, int nodePosition, int tableBits, unsigned long long& bitBuffer, int& bitCount,
+	const unsigned char* data, int dataSize, int& position)
+{
+	unsigned short next = (unsigned short)nodePosition;
+
+	bitBuffer >>= tableBits;
+	bitCount -= tableBits;
+
+	do
+	{
+		for (; bitCount <= 56 && position < dataSize; bitCount += BYTESIZE)
+			bitBuffer |= (unsigned long long)data[position++] << bitCount;
+
+		next = nodes[next].children[bitBuffer & 1];
+		bitBuffer >>= 1;
+		bitCount--;
+	} while (!(next & COMPACTLEAF) && bitCount >= 0);
+
+	return next & ~COMPACTLEAF;
+}
+
+// Function Name: decodeTableSymbols
+// Description: This function decodes symbolCount symbols from data with a lookup table of TableBits bits. The bits are
+// kept in a 64 bit buffer refilled a word at a time, so each symbol costs one lookup and one shift. When every code fits
+// in the table (MaxCodeLength <= TableBits) the compiler drops the long code path entirely; otherwise codes longer than
+// the table finish in the compact tree. Returns false if the data runs out.
+template <int TableBits, int MaxCodeLength, typename BitOps, typename Symbol>
+inline bool decodeTableSymbols(const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int symbolCount, Symbol* symbols)
+{
+	const int tableMask = (1 << TableBits) - 1;
+	vector<tableEntry> table(1 << TableBits);
+	vector<compactNode> longCodes;
+
+	fillDecodeTable(huffTree, 0, 0, 0, TableBits, table.data());
+
+	if (MaxCodeLength > TableBits)
+		buildCompactTree(huffTree, table.data(), (int)table.size(), longCodes);
+
+	unsigned long long bitBuffer = 0;
+	int bitCount = 0;
+	int position = 0;
+
+	for (int i = 0; i < symbolCount; i++)
+	{
+		// Keep at least 56 bits in the buffer, reading a whole word while one is left
+		if (position + (int)sizeof(long long) <= dataSize)
+		{
+			unsigned long long word;
+			memcpy(&word, data + position, sizeof(long long));
+
+			bitBuffer |= BitOps::shiftLeft(word, bitCount);
+			position += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+
+		else
+		{
+			for (; bitCount <= 56 && position < dataSize; bitCount += BYTESIZE)
+				bitBuffer |= (unsigned long long)data[position++] << bitCount;
+		}
+
+		tableEntry entry = table[bitBuffer & tableMask];
+
+		if (MaxCodeLength <= TableBits || entry.length != 0)
+		{
+			symbols[i] = (Symbol)entry.symbol;
+			bitBuffer = BitOps::shiftRight(bitBuffer, entry.length);
+			bitCount -= entry.length;
+		}
+
+		else
+			symbols[i] = (Symbol)decodeLongCode(longCodes, entry.symbol, TableBits, bitBuffer, bitCount, data, dataSize, position);
+
+		// Past the end of the data the buffer only holds zeros, which is never a valid place to stop
+		if (bitCount < 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Function Name: fillMultiDecodeTable
+// Description: This function fills a multi-symbol table from a single symbol table of the same size. Each index is
+// decoded greedily, and a code is added only while its whole length lies inside the index's bits, since the bits past
+// them are not known when the table is built.
+void fillMultiDecodeTable(const tableEntry* single, multiTableEntry* table)
+{
+	for (int index = 0; index < (1 << MULTITABLEBITS); index++)
+	{
+		multiTableEntry entry = {};
+
+		while (entry.count < MULTIGLYPHS)
+		{
+			tableEntry next = single[index >> entry.length];
+
+			if (next.length == 0 || entry.length + next.length > MULTITABLEBITS)
+				break;
+
+			entry.glyphs[entry.count++] = (unsigned char)next.symbol;
+			entry.length += next.length;
+		}
+
+		table[index] = entry;
+	}
+}
+
+// Function Name: decodeMultiSymbols
+// Description: This function decodes symbolCount bytes with a multi-symbol table, writing all MULTIGLYPHS glyphs of an
+// entry at once and moving on by its count. Entries whose first code is longer than the table, and the last few symbols
+// where a whole entry would not fit, are decoded one at a time with the single symbol table and the compact tree. Returns false
+// if the data runs out.
+template <typename BitOps>
+inline bool decodeMultiSymbols(const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int symbolCount, unsigned char* symbols)
+{
+	const int tableMask = (1 << MULTITABLEBITS) - 1;
+	vector<tableEntry> single(1 << MULTITABLEBITS);
+	vector<multiTableEntry> table(1 << MULTITABLEBITS);
+	vector<compactNode> longCodes;
+
+	fillDecodeTable(huffTree, 0, 0, 0, MULTITABLEBITS, single.data());
+	buildCompactTree(huffTree, single.data(), (int)single.size(), longCodes);
+	fillMultiDecodeTable(single.data(), table.data());
+
+	unsigned long long bitBuffer = 0;
+	int bitCount = 0;
+	int position = 0;
+	int i = 0;
+
+	while (i < symbolCount)
+	{
+		if (position + (int)sizeof(long long) <= dataSize)
+		{
+			unsigned long long word;
+			memcpy(&word, data + position, sizeof(long long));
+
+			bitBuffer |= BitOps::shiftLeft(word, bitCount);
+			position += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+
+		else
+		{
+			for (; bitCount <= 56 && position < dataSize; bitCount += BYTESIZE)
+				bitBuffer |= (unsigned long long)data[position++] << bitCount;
+		}
+
+		const multiTableEntry& entry = table[bitBuffer & tableMask];
+
+		if (entry.count != 0 && i + MULTIGLYPHS <= symbolCount)
+		{
+			memcpy(symbols + i, entry.glyphs, MULTIGLYPHS);
+			i += entry.count;
+			bitBuffer = BitOps::shiftRight(bitBuffer, entry.length);
+			bitCount -= entry.length;
+		}
+
+		else
+		{
+			tableEntry first = single[bitBuffer & tableMask];
+
+			if (first.length != 0)
+			{
+				symbols[i++] = (unsigned char)first.symbol;
+				bitBuffer = BitOps::shiftRight(bitBuffer, first.length);
+				bitCount -= first.length;
+			}
+
+			else
+				symbols[i++] = (unsigned char)decodeLongCode(longCodes, first.symbol, MULTITABLEBITS, bitBuffer, bitCount, data, dataSize, position);
+		}
+
+		// Past the end of the data the buffer only holds zeros, which is never a valid place to stop
+		if (bitCount < 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Function Name: multiSymbolTablePays
+// Description: This function decides from a table's code lengths whether a multi-symbol table is worth building. A code
+// of length n is taken to cover 2^-n of the symbols, which is exact for a complete code built from the frequencies.
+bool multiSymbolTablePays(const unsigned char* codeLengths, int symbolCount)
+{
+	if (!multiSymbolTables || symbolCount < MULTIMINSYMBOLS)
+		return false;
+
+	double meanLength = 0;
+
+	for (int glyph = 0; glyph < MAXGLYPHS; glyph++)
+	{
+		if (codeLengths[glyph] != 0)
+			meanLength += codeLengths[glyph] * ldexp(1.0, -codeLengths[glyph]);
+	}
+
+	return meanLength <= MULTIMAXMEANLENGTH;
+}
+
+// Function Name: decodeSymbolsWith
+// Description: This function picks the table decoder for a canonical table by its longest code length, so the common
+// short tables get a decoder with no long code path, and decodes symbolCount symbols into symbols. Byte output from
+// short codes goes to the multi-symbol decoder instead. huffTree must have been built from codeLengths. Returns false
+// if the data runs out.
+template <typename BitOps, typename Symbol>
+inline bool decodeSymbolsWith(const unsigned char* codeLengths, const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int symbolCount, Symbol* symbols)
+{
+	int maxCodeLength = *max_element(codeLengths, codeLengths + MAXGLYPHS);
+
+	if (maxCodeLength == 0)
+		return symbolCount == 0;
+
+	if constexpr (sizeof(Symbol) == 1)
+	{
+		if (multiSymbolTablePays(codeLengths, symbolCount))
+			return decodeMultiSymbols<BitOps>(huffTree, data, dataSize, symbolCount, (unsigned char*)symbols);
+	}
+
+	if (maxCodeLength <= 11)
+		return decodeTableSymbols<11, 11, BitOps>(huffTree, data, dataSize, symbolCount, symbols);
+
+	if (maxCodeLength <= 12)
+		return decodeTableSymbols<12, 12, BitOps>(huffTree, data, dataSize, symbolCount, symbols);
+
+	if (maxCodeLength <= 15)
+		return decodeTableSymbols<15, 15, BitOps>(huffTree, data, dataSize, symbolCount, symbols);
+
+	return decodeTableSymbols<11, MAXCODELENGTH, BitOps>(huffTree, data, dataSize, symbolCount, symbols);
+}
+
+#ifdef PUFF_X64
+// Function Name: decodeSymbolsBmi2
+// Description: This function is decodeSymbolsWith compiled with BMI2 shifts.
+template <typename Symbol>
+PUFF_TARGET_BMI2 bool decodeSymbolsBmi2(const unsigned char* codeLengths, const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int symbolCount, Symbol* symbols)
+{
+	return decodeSymbolsWith<bmi2BitOps>(codeLengths, huffTree, data, dataSize, symbolCount, symbols);
+}
+#endif
+
+// Function Name: decodeSymbols
+// Description: This function decodes symbolCount symbols of a canonical table with the selected decoder kernel.
+template <typename Symbol>
+bool decodeSymbols(const unsigned char* codeLengths, const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int symbolCount, Symbol* symbols)
+{
+#ifdef PUFF_X64
+	if (decoderKernel == KERNELBMI2)
+		return decodeSymbolsBmi2(codeLengths, huffTree, data, dataSize, symbolCount, symbols);
+#endif
+
+	return decodeSymbolsWith<portableBitOps>(codeLengths, huffTree, data, dataSize, symbolCount, symbols);
+}
+
+// Function Name: decodeTreeData
+// Description: This function decodes rawLength bytes coded with a canonical table and appends them to output.
+// Returns false if the data runs out.
+bool decodeTreeData(const unsigned char* codeLengths, const vector<huffEntry>& huffTree, const unsigned char* data, int dataSize, int rawLength, string& output)
+{
+	size_t blockStart = output.size();
+	output.resize(blockStart + rawLength);
+
+	return decodeSymbols(codeLengths, huffTree, data, dataSize, rawLength, &output[0] + blockStart);
+}
+
+// Function Name: loadDictionary
+// Description: This function reads a dictionary file written by huff --train and adds it to the loaded dictionaries.
+// Returns false if the file is not a dictionary.
+bool loadDictionary(string& dictionaryName)
+{
+	ifstream fin(dictionaryName, ios::in | ios::binary);
+	huffDictionary dictionary;
+	int magic = 0;
+
+	fin.read((char*)&magic, sizeof(int));
+	fin.read((char*)&dictionary.id, sizeof(int));
+	fin.read((char*)dictionary.codeLengths, MAXGLYPHS);
+
+	if (!fin || magic != DICTIONARY_MAGIC)
+		return false;
+
+	if (!buildTreeFromCodeLengths(dictionary.codeLengths, dictionary.huffTree))
+		return false;
+
+	dictionaries.push_back(dictionary);
+
+	return true;
+}
+
+// Function Name: findDictionary
+// Description: This function returns the loaded dictionary with the given ID, or nullptr if it was not loaded.
+huffDictionary* findDictionary(int dictionaryId)
+{
+	for (int i = 0; i < (int)dictionaries.size(); i++)
+	{
+		if (dictionaries[i].id == dictionaryId)
+			return &dictionaries[i];
+	}
+
+	return nullptr;
+}
+
+// Function Name: loadReference
+// Description: This function reads a reference file for delta blocks and adds it to the loaded references.
+// Returns false if the file can not be read.
+bool loadReference(string& referenceName)
+{
+	ifstream fin(referenceName, ios::in | ios::binary);
+	stringstream contents;
+	referenceFile reference;
+
+	if (!fin)
+		return false;
+
+	contents << fin.rdbuf();
+	reference.data = contents.str();
+	reference.checksum = ~updateCrc(CRCINITIAL, reference.data.data(), reference.data.size());
+	references.push_back(reference);
+
+	return true;
+}
+
+// Function Name: findReference
+// Description: This function returns the loaded reference with the given checksum and length, or nullptr if it was not
+// loaded.
+referenceFile* findReference(unsigned int checksum, int length)
+{
+	for (int i = 0; i < (int)references.size(); i++)
+	{
+		if (references[i].checksum == checksum && (int)references[i].data.size() == length)
+			return &references[i];
+	}
+
+	return nullptr;
+}
+
+// Function Name: resetAdaptiveTree
+// Description: This function resets an adaptive huffman tree to a lone NYT (not yet transmitted) node at the root.
+void resetAdaptiveTree(adaptiveTree& tree)
+{
+	for (int i = 0; i < ADAPTIVEGLYPHS; i++)
+		tree.leaves[i] = -1;
+
+	tree.notYetTransmitted = ADAPTIVEROOT;
+	tree.nodes[ADAPTIVEROOT] = adaptiveNode{ -1, 0, -1, -1, -1 };
+}
+
+// Function Name: swapAdaptiveNodes
+// Description: This function swaps the subtrees at two node numbers. Parents keep pointing at the same numbers, so only
+// the children and the leaf of each subtree need their pointers fixed.
+void swapAdaptiveNodes(adaptiveTree& tree, int first, int second)
+{
+	swap(tree.nodes[first].glyph, tree.nodes[second].glyph);
+	swap(tree.nodes[first].weight, tree.nodes[second].weight);
+	swap(tree.nodes[first].leftPointer, tree.nodes[second].leftPointer);
+	swap(tree.nodes[first].rightPointer, tree.nodes[second].rightPointer);
+
+	int numbers[2] = { first, second };
+
+	for (int i = 0; i < 2; i++)
+	{
+		adaptiveNode& node = tree.nodes[numbers[i]];
+
+		if (node.leftPointer != -1)
+		{
+			tree.nodes[node.leftPointer].parent = numbers[i];
+			tree.nodes[node.rightPointer].parent = numbers[i];
+		}
+
+		else if (node.glyph != -1)
+			tree.leaves[node.glyph] = numbers[i];
+	}
+}
+
+// Function Name: updateAdaptiveTree
+// Description: This function adds one occurrence of a glyph to the adaptive huffman tree with the FGK update, splitting
+// the NYT node first if the glyph is new. It must make exactly the same changes as updateAdaptiveTree in huff.
+void updateAdaptiveTree(adaptiveTree& tree, int glyph)
+{
+	int current = tree.leaves[glyph];
+
+	if (current == -1)
+	{
+		int parent = tree.notYetTransmitted;
+		current = parent - 1;
+
+		tree.nodes[parent].leftPointer = parent - 2;
+		tree.nodes[parent].rightPointer = current;
+		tree.nodes[current] = adaptiveNode{ glyph, 0, parent, -1, -1 };
+		tree.nodes[parent - 2] = adaptiveNode{ -1, 0, parent, -1, -1 };
+
+		tree.leaves[glyph] = current;
+		tree.notYetTransmitted = parent - 2;
+	}
+
+	while (current != -1)
+	{
+		// find the highest numbered node with the same weight
+		int leader = current;
+		while (leader < ADAPTIVEROOT && tree.nodes[leader + 1].weight == tree.nodes[current].weight)
+			leader++;
+
+		if (leader != current && leader != tree.nodes[current].parent)
+		{
+			swapAdaptiveNodes(tree, current, leader);
+			current = leader;
+		}
+
+		tree.nodes[current].weight++;
+		current = tree.nodes[current].parent;
+	}
+}
+
+// Function Name: decodeAdaptiveData
+// Description: This function decodes rawLength glyphs from the bits of data, walking the adaptive tree from the root to a
+// leaf for each one. Reaching the NYT node means the next 8 bits are a new glyph. The tree is updated after every glyph,
+// so it carries on into the next adaptive block. Returns false if the data runs out first.
+bool decodeAdaptiveData(adaptiveTree& tree, const unsigned char* data, int dataSize, int rawLength, string& output)
+{
+	int bitPosition = 0;
+	int dataBitSize = dataSize * BYTESIZE;
+
+	for (int decodedGlyphs = 0; decodedGlyphs < rawLength; decodedGlyphs++)
+	{
+		int nodePosition = ADAPTIVEROOT;
+
+		while (tree.nodes[nodePosition].leftPointer != -1)
+		{
+			if (bitPosition >= dataBitSize)
+				return false;
+
+			if ((data[bitPosition / BYTESIZE] >> (bitPosition % BYTESIZE)) & 1)
+				nodePosition = tree.nodes[nodePosition].rightPointer;
+			else
+				nodePosition = tree.nodes[nodePosition].leftPointer;
+
+			bitPosition++;
+		}
+
+		int glyph = tree.nodes[nodePosition].glyph;
+
+		if (nodePosition == tree.notYetTransmitted)
+		{
+			if (bitPosition + BYTESIZE > dataBitSize)
+				return false;
+
+			glyph = 0;
+			for (int i = 0; i < BYTESIZE; i++, bitPosition++)
+				glyph |= ((data[bitPosition / BYTESIZE] >> (bitPosition % BYTESIZE)) & 1) << i;
+		}
+
+		output += (char)glyph;
+		updateAdaptiveTree(tree, glyph);
+	}
+
+	return true;
+}
+
+// Function Name: readCompactCodeLengths
+// Description: This function reads a table stored by writeCompactCodeLengths in huff, a bitmap of which of the first
+// glyphCount glyphs are used followed by a 4 bit code length for each, starting at position in data. position is moved
+// past the table. Returns false if the table runs past dataSize.
+bool readCompactCodeLengths(const unsigned char* data, int dataSize, int& position, unsigned char* codeLengths, int glyphCount)
+{
+	int bitmapSize = (glyphCount + BYTESIZE - 1) / BYTESIZE;
+
+	if (position + bitmapSize > dataSize)
+		return false;
+
+	const unsigned char* bitmap = data + position;
+	bool highNibble = false;
+
+	position += bitmapSize;
+
+	for (int glyph = 0; glyph < MAXGLYPHS; glyph++)
+	{
+		codeLengths[glyph] = 0;
+
+		if (glyph < glyphCount && (bitmap[glyph / BYTESIZE] >> (glyph % BYTESIZE)) & 1)
+		{
+			if (position >= dataSize)
+				return false;
+
+			codeLengths[glyph] = highNibble ? data[position++] >> 4 : data[position] & 0x0F;
+			highNibble = !highNibble;
+		}
+	}
+
+	if (highNibble)
+		position++;
+
+	return true;
+}
+
+// Function Name: readCodeLengthChanges
+// Description: This function applies the changes stored by writeCodeLengthChanges in huff, a bitmap of the byte values
+// whose code lengths changed followed by a 4 bit new length for each, starting at position in data. position is moved
+// past the changes. Returns false if they run past dataSize.
+bool readCodeLengthChanges(const unsigned char* data, int dataSize, int& position, unsigned char* codeLengths)
+{
+	int bitmapSize = BYTEGLYPHS / BYTESIZE;
+
+	if (position + bitmapSize > dataSize)
+		return false;
+
+	const unsigned char* bitmap = data + position;
+	bool highNibble = false;
+
+	position += bitmapSize;
+
+	for (int glyph = 0; glyph < BYTEGLYPHS; glyph++)
+	{
+		if ((bitmap[glyph / BYTESIZE] >> (glyph % BYTESIZE)) & 1)
+		{
+			if (position >= dataSize)
+				return false;
+
+			codeLengths[glyph] = highNibble ? data[position++] >> 4 : data[position] & 0x0F;
+			highNibble = !highNibble;
+		}
+	}
+
+	if (highNibble)
+		position++;
+
+	return true;
+}
+
+// Function Name: decodeHuffmanData
+// Description: This function decodes a huffman block. A BLOCK_HUFFMAN block stores its canonical table in the compact
+// form ahead of the bits, a BLOCK_HUFFMAN_PATCH block the changes to the previous table, and a BLOCK_HUFFMAN_REUSE block
+// only the bits. codeLengths and huffTree hold the previous table, empty if there is none, and are left holding this
+// block's. Returns false if the table is malformed or missing.
+bool decodeHuffmanData(const unsigned char* payload, int payloadLength, int rawLength, int blockType, unsigned char* codeLengths,
+	vector<huffEntry>& huffTree, string& output)
+{
+	int position = 0;
+
+	if (blockType == BLOCK_HUFFMAN)
+	{
+		if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, BYTEGLYPHS)
+			|| !buildTreeFromCodeLengths(codeLengths, huffTree))
+			return false;
+	}
+
+	else if (huffTree.empty())
+		return false;
+
+	else if (blockType == BLOCK_HUFFMAN_PATCH)
+	{
+		if (!readCodeLengthChanges(payload, payloadLength, position, codeLengths)
+			|| !buildTreeFromCodeLengths(codeLengths, huffTree))
+			return false;
+	}
+
+	return decodeTreeData(codeLengths, huffTree, payload + position, payloadLength - position, rawLength, output);
+}
+
+// Function Name: decodeOrder1Data
+// Description: This function decodes an order-1 block. It reads the table count, the table used by each previous byte
+// when there is more than one table, and the tables themselves. Each table gets a lookup table like decodeTableSymbols
+// uses, with codes longer than it finished in a compact tree, and the previous byte picks the lookup table for each
+// glyph. Returns false if the block is malformed.
+bool decodeOrder1Data(const unsigned char* payload, int payloadLength, int rawLength, string& output)
+{
+	int tableCount = 0;
+	int position = sizeof(int);
+	const unsigned char singleTable[ORDER1CONTEXTS] = { 0 };
+
+	if (payloadLength < position)
+		return false;
+
+	memcpy(&tableCount, payload, sizeof(int));
+
+	if (tableCount < 0 || tableCount > ORDER1CONTEXTS + 1)
+		return false;
+
+	// The map from previous byte to table is only stored when there is more than one table
+	const unsigned char* contextTable = singleTable;
+
+	if (tableCount > 1)
+	{
+		if (payloadLength < position + ORDER1CONTEXTS)
+			return false;
+
+		contextTable = payload + position;
+		position += ORDER1CONTEXTS;
+	}
+
+	const int tableSize = 1 << ORDER1TABLEBITS;
+	const int tableMask = tableSize - 1;
+	vector<tableEntry> tables((size_t)tableCount * tableSize);
+	vector<vector<compactNode>> longCodes(tableCount);
+	vector<huffEntry> huffTree;
+	unsigned char codeLengths[MAXGLYPHS];
+
+	for (int t = 0; t < tableCount; t++)
+	{
+		if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, BYTEGLYPHS)
+			|| !buildTreeFromCodeLengths(codeLengths, huffTree))
+			return false;
+
+		tableEntry* table = &tables[(size_t)t * tableSize];
+		fillDecodeTable(huffTree, 0, 0, 0, ORDER1TABLEBITS, table);
+		buildCompactTree(huffTree, table, tableSize, longCodes[t]);
+	}
+
+	const unsigned char* data = payload + position;
+	int dataSize = payloadLength - position;
+	size_t blockStart = output.size();
+	unsigned long long bitBuffer = 0;
+	int bitCount = 0;
+	unsigned char context = 0;
+
+	output.resize(blockStart + rawLength);
+	position = 0;
+
+	char* glyphs = &output[0] + blockStart;
+
+	for (int i = 0; i < rawLength; i++)
+	{
+		int t = contextTable[context];
+
+		if (t >= tableCount)
+			return false;
+
+		// Keep at least 56 bits in the buffer, reading a whole word while one is left
+		if (position + (int)sizeof(long long) <= dataSize)
+		{
+			unsigned long long word;
+			memcpy(&word, data + position, sizeof(long long));
+
+			bitBuffer |= word << bitCount;
+			position += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+
+		else
+		{
+			for (; bitCount <= 56 && position < dataSize; bitCount += BYTESIZE)
+				bitBuffer |= (unsigned long long)data[position++] << bitCount;
+		}
+
+		tableEntry entry = tables[(size_t)t * tableSize + (bitBuffer & tableMask)];
+
+		if (entry.length != 0)
+		{
+			context = (unsigned char)entry.symbol;
+			bitBuffer >>= entry.length;
+			bitCount -= entry.length;
+		}
+
+		else
+			context = (unsigned char)decodeLongCode(longCodes[t], entry.symbol, ORDER1TABLEBITS, bitBuffer, bitCount, data, dataSize, position);
+
+		// Past the end of the data the buffer only holds zeros, which is never a valid place to stop
+		if (bitCount < 0)
+			return false;
+
+		glyphs[i] = (char)context;
+	}
+
+	return true;
+}
+
+// Function Name: readBits
+// Description: This function reads bitCount bits from the reader, lowest bit first, into value. Returns false if the
+// data runs out.
+bool readBits(bitReader& reader, int bitCount, int& value)
+{
+	if (reader.position + bitCount > reader.bitSize)
+		return false;
+
+	value = 0;
+	for (int i = 0; i < bitCount; i++, reader.position++)
+		value |= ((reader.data[reader.position / BYTESIZE] >> (reader.position % BYTESIZE)) & 1) << i;
+
+	return true;
+}
+
+// Function Name: readTreeGlyph
+// Description: This function walks a huffman tree from the root following bits from the reader until it reaches a leaf
+// and returns its glyph. Returns -1 if the data runs out or the bits leave the tree.
+int readTreeGlyph(bitReader& reader, const vector<huffEntry>& huffTree)
+{
+	int nodePosition = 0;
+
+	while (huffTree[nodePosition].leftPointer != -1 || huffTree[nodePosition].rightPointer != -1)
+	{
+		if (reader.position >= reader.bitSize)
+			return -1;
+
+		if ((reader.data[reader.position / BYTESIZE] >> (reader.position % BYTESIZE)) & 1)
+			nodePosition = huffTree[nodePosition].rightPointer;
+		else
+			nodePosition = huffTree[nodePosition].leftPointer;
+
+		reader.position++;
+	}
+
+	return huffTree[nodePosition].glyph;
+}
+
+// Function Name: readLzValue
+// Description: This function turns a match length or distance code from huff's getLzCode back into its value, reading
+// the extra bits that follow the code. Returns -1 if the data runs out.
+int readLzValue(bitReader& reader, int code)
+{
+	if (code < 4)
+		return code;
+
+	int extraBitCount = code / 2 - 1;
+	int extraValue = 0;
+
+	if (!readBits(reader, extraBitCount, extraValue))
+		return -1;
+
+	return ((2 | (code & 1)) << extraBitCount) | extraValue;
+}
+
+// Function Name: decodeLzData
+// Description: This function decodes an LZ block. It reads the literal, length and distance tables, then decodes
+// literals and matches until rawLength bytes have been produced, copying each match from earlier in the block's output
+// or from the historyLength bytes of output before the block. Returns false if the block is malformed or a match reaches
+// back further than that.
+bool decodeLzData(const unsigned char* payload, int payloadLength, int rawLength, size_t historyLength, string& output)
+{
+	unsigned char codeLengths[MAXGLYPHS];
+	vector<huffEntry> literalTree;
+	vector<huffEntry> lengthTree;
+	vector<huffEntry> distanceTree;
+	int position = 0;
+
+	if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, MAXGLYPHS)
+		|| !buildTreeFromCodeLengths(codeLengths, literalTree))
+		return false;
+
+	if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, LZLENGTHCODES)
+		|| !buildTreeFromCodeLengths(codeLengths, lengthTree))
+		return false;
+
+	if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, LZDISTANCECODES)
+		|| !buildTreeFromCodeLengths(codeLengths, distanceTree))
+		return false;
+
+	bitReader reader = { payload + position, (payloadLength - position) * BYTESIZE, 0 };
+	size_t blockStart = output.size();
+	size_t blockEnd = blockStart + rawLength;
+
+	output.reserve(blockEnd);
+
+	while (output.size() < blockEnd)
+	{
+		int glyph = readTreeGlyph(reader, literalTree);
+
+		if (glyph == -1)
+			return false;
+
+		if (glyph != LZMATCHGLYPH)
+		{
+			output += (char)glyph;
+			continue;
+		}
+
+		int lengthCode = readTreeGlyph(reader, lengthTree);
+		int length = lengthCode == -1 ? -1 : readLzValue(reader, lengthCode);
+		int distanceCode = length == -1 ? -1 : readTreeGlyph(reader, distanceTree);
+		int distance = distanceCode == -1 ? -1 : readLzValue(reader, distanceCode);
+
+		if (distance == -1)
+			return false;
+
+		length += LZMINMATCH;
+		distance += 1;
+
+		if ((size_t)distance > output.size() - blockStart + historyLength || output.size() + (size_t)length > blockEnd)
+			return false;
+
+		// Copy one byte at a time since a match may overlap the bytes it produces
+		size_t from = output.size() - distance;
+		for (int i = 0; i < length; i++)
+			output += output[from + i];
+	}
+
+	return true;
+}
+
+// Function Name: decodeDeltaData
+// Description: This function decodes a delta block by decoding its LZ data with the reference in front of the output,
+// then removing the reference again. Returns false if the block is malformed.
+bool decodeDeltaData(const referenceFile& reference, const unsigned char* payload, int payloadLength, int rawLength, string& output)
+{
+	output = reference.data;
+
+	bool decoded = decodeLzData(payload, payloadLength, rawLength, reference.data.size(), output);
+	output.erase(0, reference.data.size());
+
+	return decoded;
+}
+
+// Function Name: decodeBwtData
+// Description: This function decodes a BWT block. It reads the row of the original string and the symbol count, decodes
+// the symbols with the block's table, undoes the zero run and move-to-front stages, then inverts the Burrows-Wheeler
+// transform by following the LF mapping back from the row that starts with the sentinel. Returns false if the block is
+// malformed.
+bool decodeBwtData(const unsigned char* payload, int payloadLength, int rawLength, string& output)
+{
+	int primaryIndex = 0;
+	int symbolCount = 0;
+	int position = 2 * sizeof(int);
+
+	if (payloadLength < position || rawLength < 0)
+		return false;
+
+	memcpy(&primaryIndex, payload, sizeof(int));
+	memcpy(&symbolCount, payload + sizeof(int), sizeof(int));
+
+	if (rawLength > 0 && (primaryIndex < 1 || primaryIndex > rawLength))
+		return false;
+
+	unsigned char codeLengths[MAXGLYPHS];
+	vector<huffEntry> huffTree;
+
+	if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, MAXGLYPHS)
+		|| !buildTreeFromCodeLengths(codeLengths, huffTree))
+		return false;
+
+	// Every symbol takes at least one bit
+	if (symbolCount < 0 || symbolCount > (payloadLength - position) * BYTESIZE)
+		return false;
+
+	vector<unsigned short> symbols(symbolCount);
+
+	if (!decodeSymbols(codeLengths, huffTree, payload + position, payloadLength - position, symbolCount, symbols.data()))
+		return false;
+
+	// Undo the zero runs and move-to-front
+	unsigned char order[BYTEGLYPHS];
+	for (int i = 0; i < BYTEGLYPHS; i++)
+		order[i] = (unsigned char)i;
+
+	string transformed;
+	transformed.reserve(rawLength);
+
+	long long zeroRun = 0;
+	long long runWeight = 1;
+
+	for (int i = 0; i <= symbolCount; i++)
+	{
+		int symbol = i < symbolCount ? symbols[i] : -1;
+
+		if (symbol == BWTRUNA || symbol == BWTRUNB)
+		{
+			zeroRun += runWeight << (symbol == BWTRUNB);
+			runWeight <<= 1;
+
+			if (zeroRun > rawLength)
+				return false;
+
+			continue;
+		}
+
+		if ((int)transformed.size() + zeroRun > rawLength)
+			return false;
+
+		transformed.append((size_t)zeroRun, (char)order[0]);
+		zeroRun = 0;
+		runWeight = 1;
+
+		if (symbol == -1)
+			continue;
+
+		int index = symbol - 1;
+		unsigned char glyph = order[index];
+
+		memmove(order + 1, order, index);
+		order[0] = glyph;
+
+		transformed += (char)glyph;
+	}
+
+	if ((int)transformed.size() != rawLength)
+		return false;
+
+	// Row primaryIndex of the last column holds the sentinel, which sorts before every byte
+	int counts[BYTEGLYPHS] = { 0 };
+
+	for (int i = 0; i < rawLength; i++)
+		counts[(unsigned char)transformed[i]]++;
+
+	int firstRow[BYTEGLYPHS];
+	firstRow[0] = 1;
+	for (int c = 1; c < BYTEGLYPHS; c++)
+		firstRow[c] = firstRow[c - 1] + counts[c - 1];
+
+	vector<int> lastToFirst(rawLength + 1);
+	int seen[BYTEGLYPHS] = { 0 };
+
+	for (int row = 0; row <= rawLength; row++)
+	{
+		if (row == primaryIndex)
+			continue;
+
+		unsigned char glyph = transformed[row < primaryIndex ? row : row - 1];
+		lastToFirst[row] = firstRow[glyph] + seen[glyph]++;
+	}
+
+	size_t blockStart = output.size();
+	output.resize(blockStart + rawLength);
+
+	int row = 0;
+	for (int i = rawLength - 1; i >= 0; i--)
+	{
+		if (row == primaryIndex)
+			return false;
+
+		output[blockStart + i] = transformed[row < primaryIndex ? row : row - 1];
+		row = lastToFirst[row];
+	}
+
+	return true;
+}
+
+// Function Name: decodeBwtBatch
+// Description: This function decodes a batch of consecutive BWT blocks, one pool task per block, then checks and writes
+// their output in order and empties the batch. firstBlock is the number of the first block in the batch, used to report
+// a checksum mismatch, and fileCrc is the running checksum of the file. Returns false if any block could not be decoded.
+bool decodeBwtBatch(vector<pendingBlock>& batch, ostream& fout, int firstBlock, unsigned int& fileCrc)
+{
+	atomic<int> remainingBlocks((int)batch.size());
+
+	auto decodeBlock = [&batch, &remainingBlocks](int i)
+	{
+		batch[i].decoded = decodeBwtData(batch[i].payload.data(), (int)batch[i].payload.size(), batch[i].rawLength, batch[i].output)
+			&& ~updateCrc(CRCINITIAL, batch[i].output.data(), batch[i].output.size()) == batch[i].checksum;
+		remainingBlocks--;
+	};
+
+	for (int i = (int)batch.size() - 1; i > 0; i--)
+		submitPoolTask([&decodeBlock, i]() { decodeBlock(i); });
+
+	if (!batch.empty())
+		decodeBlock(0);
+
+	waitForPoolTasks(remainingBlocks);
+
+	bool decoded = true;
+
+	for (int i = 0; i < (int)batch.size() && decoded; i++)
+	{
+		decoded = batch[i].decoded;
+
+		if (decoded)
+		{
+			fileCrc = updateCrc(fileCrc, batch[i].output.data(), batch[i].output.size());
+			fout.write(batch[i].output.data(), batch[i].output.size());
+		}
+
+		else
+			cerr << "block " << firstBlock + i << " is damaged" << endl;
+	}
+
+	fout.flush();
+	batch.clear();
+
+	return decoded;
+}
+
+// Function Name: readBlock
+// Description: This function reads the type of the next block of a block format huf image, skipping any BLOCK_APPENDED
+// markers, and for any block but BLOCK_END its header and payload. Returns false if the header is damaged or the block
+// is cut short.
+bool readBlock(istream& fin, int blockNumber, int& blockType, int& rawLength, unsigned int& checksum, vector<unsigned char>& payload)
+{
+	fin.read((char*)&blockType, sizeof(int));
+
+	while (fin && blockType == BLOCK_APPENDED)
+	{
+		unsigned int staleChecksum = 0;
+		fin.read((char*)&staleChecksum, sizeof(int));
+		fin.read((char*)&blockType, sizeof(int));
+	}
+
+	if (!fin)
+	{
+		cerr << "block " << blockNumber << " is cut short" << endl;
+		return false;
+	}
+
+	if (blockType == BLOCK_END)
+		return true;
+
+	int payloadLength = 0;
+
+	fin.read((char*)&rawLength, sizeof(int));
+	fin.read((char*)&payloadLength, sizeof(int));
+	fin.read((char*)&checksum, sizeof(int));
+
+	// The decoders count payload bits in an int
+	if (!fin || rawLength < 0 || payloadLength < 0 || payloadLength > INT_MAX / BYTESIZE)
+	{
+		cerr << "block " << blockNumber << " has a damaged header" << endl;
+		return false;
+	}
+
+	payload.resize(payloadLength);
+	fin.read((char*)payload.data(), payloadLength);
+
+	if (!fin)
+	{
+		cerr << "block " << blockNumber << " is cut short" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Function Name: decodeBlock
+// Description: This function decodes the payload of one block into output, whatever its type, keeping what later
+// blocks need in context. BWT blocks are decoded here one at a time, where decodeBlockFile batches them instead. Returns
+// false if the block can not be decoded, after saying why when it needs a dictionary or reference that is not loaded.
+bool decodeBlock(blockContext& context, int blockType, const unsigned char* payload, int payloadLength, int rawLength, string& output)
+{
+	bool decoded = false;
+
+	output.clear();
+
+	if (blockType == BLOCK_DICTIONARY)
+	{
+		int dictionaryId = 0;
+		huffDictionary* dictionary = nullptr;
+
+		if (payloadLength >= (int)sizeof(int))
+		{
+			memcpy(&dictionaryId, payload, sizeof(int));
+			dictionary = findDictionary(dictionaryId);
+		}
+
+		if (payloadLength < (int)sizeof(int))
+			decoded = false;
+
+		else if (dictionary == nullptr)
+			cerr << context.fileName << " needs dictionary " << hex << (unsigned int)dictionaryId << dec << ", load it with --dictionary" << endl;
+
+		else
+			decoded = decodeTreeData(dictionary->codeLengths, dictionary->huffTree, payload + sizeof(int), payloadLength - sizeof(int), rawLength, output);
+	}
+
+	else if (blockType == BLOCK_ADAPTIVE)
+	{
+		// The model carries on from the previous adaptive block, and is reset at the same point huff resets it
+		if (context.tree == nullptr)
+		{
+			context.tree = new adaptiveTree;
+			resetAdaptiveTree(*context.tree);
+		}
+
+		else if (context.tree->nodes[ADAPTIVEROOT].weight >= ADAPTIVERESETWEIGHT)
+			resetAdaptiveTree(*context.tree);
+
+		decoded = decodeAdaptiveData(*context.tree, payload, payloadLength, rawLength, output);
+	}
+
+	else if (blockType == BLOCK_ORDER1)
+		decoded = decodeOrder1Data(payload, payloadLength, rawLength, output);
+
+	else if (blockType == BLOCK_LZ)
+		decoded = decodeLzData(payload, payloadLength, rawLength, 0, output);
+
+	else if (blockType == BLOCK_BWT)
+		decoded = decodeBwtData(payload, payloadLength, rawLength, output);
+
+	else if (blockType == BLOCK_DELTA)
+	{
+		unsigned int referenceChecksum = 0;
+		int referenceLength = 0;
+		referenceFile* reference = nullptr;
+
+		if (payloadLength >= 2 * (int)sizeof(int))
+		{
+			memcpy(&referenceChecksum, payload, sizeof(int));
+			memcpy(&referenceLength, payload + sizeof(int), sizeof(int));
+			reference = findReference(referenceChecksum, referenceLength);
+		}
+
+		if (payloadLength < 2 * (int)sizeof(int))
+			decoded = false;
+
+		else if (reference == nullptr)
+			cerr << context.fileName << " is a delta against a " << referenceLength << " byte reference with checksum " << hex
+				<< referenceChecksum << dec << ", load it with --reference" << endl;
+
+		else
+			decoded = decodeDeltaData(*reference, payload + 2 * sizeof(int), payloadLength - 2 * sizeof(int), rawLength, output);
+	}
+
+	else if (blockType == BLOCK_HUFFMAN || blockType == BLOCK_HUFFMAN_REUSE || blockType == BLOCK_HUFFMAN_PATCH)
+		decoded = decodeHuffmanData(payload, payloadLength, rawLength, blockType, context.huffmanLengths, context.huffmanTree, output);
+
+	else if (blockType == BLOCK_STORED)
+	{
+		decoded = payloadLength == rawLength;
+		output.assign((const char*)payload, payloadLength);
+	}
+
+	else
+		cerr << context.fileName << " has an unknown block type " << blockType << endl;
+
+	return decoded;
+}
+
+// Function Name: feedDecodeStream
+// Description: This function adds a chunk of input to a decode stream. Nothing is decoded until output is wanted.
+void feedDecodeStream(decodeStream& stream, const char* data, size_t length)
+{
+	stream.input.erase(stream.input.begin(), stream.input.begin() + stream.inputPosition);
+	stream.inputPosition = 0;
+	stream.input.insert(stream.input.end(), data, data + length);
+}
+
+// Function Name: decodeStreamBlock
+// Description: This function decodes the next block of a decode stream that holds any data into its output, once the
+// whole block has been fed, reading the file header first and skipping BLOCK_APPENDED markers. After the last block it
+// checks the file checksum. Returns false if more input is needed, or once the image has finished or failed.
+bool decodeStreamBlock(decodeStream& stream)
+{
+	stream.output.clear();
+	stream.outputPosition = 0;
+
+	while (!stream.finished && !stream.failed)
+	{
+		const unsigned char* data = stream.input.data() + stream.inputPosition;
+		size_t available = stream.input.size() - stream.inputPosition;
+		int fields[4] = { 0 };
+
+		if (available > 0)
+			memcpy(fields, data, min(available, sizeof(fields)));
+
+		// Every step needs at least two fields: the magic and name length, a block type and stale checksum, a block
+		// type and header, or the end block and file checksum
+		if (available < 2 * sizeof(int))
+			return false;
+
+		if (!stream.headerRead)
+		{
+			if (fields[0] != BLOCK_FILE_MAGIC || fields[1] < 0)
+			{
+				cerr << "the input is not a block format huf image" << endl;
+				stream.failed = true;
+				return false;
+			}
+
+			if (available < 2 * sizeof(int) + fields[1])
+				return false;
+
+			stream.context.fileName.assign((const char*)data + 2 * sizeof(int), fields[1]);
+			stream.inputPosition += 2 * sizeof(int) + fields[1];
+			stream.headerRead = true;
+			continue;
+		}
+
+		if (fields[0] == BLOCK_APPENDED)
+		{
+			stream.inputPosition += 2 * sizeof(int);
+			continue;
+		}
+
+		if (fields[0] == BLOCK_END)
+		{
+			stream.inputPosition += 2 * sizeof(int);
+			stream.finished = true;
+			stream.failed = ~stream.fileCrc != (unsigned int)fields[1];
+
+			if (stream.failed)
+				cerr << stream.context.fileName << " does not match its file checksum" << endl;
+
+			return false;
+		}
+
+		if (available < sizeof(fields))
+			return false;
+
+		int rawLength = fields[1];
+		int payloadLength = fields[2];
+
+		// The decoders count payload bits in an int
+		if (rawLength < 0 || payloadLength < 0 || payloadLength > INT_MAX / BYTESIZE)
+		{
+			cerr << "block " << stream.blockNumber << " has a damaged header" << endl;
+			stream.failed = true;
+			return false;
+		}
+
+		if (available < sizeof(fields) + payloadLength)
+			return false;
+
+		if (!decodeBlock(stream.context, fields[0], data + sizeof(fields), payloadLength, rawLength, stream.output)
+			|| (int)stream.output.size() != rawLength || ~updateCrc(CRCINITIAL, stream.output.data(), stream.output.size()) != (unsigned int)fields[3])
+		{
+			cerr << "block " << stream.blockNumber << " is damaged" << endl;
+			stream.output.clear();
+			stream.failed = true;
+			return false;
+		}
+
+		stream.inputPosition += sizeof(fields) + payloadLength;
+		stream.fileCrc = updateCrc(stream.fileCrc, stream.output.data(), stream.output.size());
+		stream.blockNumber++;
+
+		if (!stream.output.empty())
+			return true;
+	}
+
+	return false;
+}
+
+// Function Name: drainDecodeStream
+// Description: This function copies up to size decoded bytes into buffer, decoding more of the input fed so far as it
+// needs to. Returns the number of bytes copied, which is less than size when more input is needed or the image has
+// ended.
+size_t drainDecodeStream(decodeStream& stream, char* buffer, size_t size)
+{
+	size_t copied = 0;
+
+	while (copied < size && (stream.outputPosition < stream.output.size() || decodeStreamBlock(stream)))
+	{
+		size_t count = min(size - copied, stream.output.size() - stream.outputPosition);
+
+		memcpy(buffer + copied, stream.output.data() + stream.outputPosition, count);
+		copied += count;
+		stream.outputPosition += count;
+	}
+
+	return copied;
+}
+
+// Function Name: blockReader::blockReader
+// Description: This constructor accepts an istream positioned at the start of a block format huf image. Nothing is
+// read until the data is asked for.
+blockReader::blockReader(istream& input) : fin(input), chunk(CATCHUNKSIZE)
+{
+}
+
+// Function Name: blockReader::nextBlock
+// Description: This function feeds the stream from the istream until it has decoded another block that holds data.
+// Returns false once there is no more data, with stream.failed set if it stopped because something did not check out
+// or the image was cut short.
+bool blockReader::nextBlock()
+{
+	while (!decodeStreamBlock(stream))
+	{
+		if (stream.finished || stream.failed)
+			return false;
+
+		fin.read(chunk.data(), chunk.size());
+
+		if (fin.gcount() == 0)
+		{
+			cerr << "the huf image is cut short" << endl;
+			stream.failed = true;
+			return false;
+		}
+
+		feedDecodeStream(stream, chunk.data(), (size_t)fin.gcount());
+	}
+
+	return true;
+}
+
+// Function Name: blockReader::read
+// Description: This function copies up to size decoded bytes into buffer, decoding more blocks as it needs them.
+// Returns the number of bytes copied, which is less than size only once the data has run out.
+size_t blockReader::read(char* buffer, size_t size)
+{
+	size_t copied = 0;
+
+	while (copied < size && (stream.outputPosition < stream.output.size() || nextBlock()))
+		copied += drainDecodeStream(stream, buffer + copied, size - copied);
+
+	return copied;
+}
+
+// Function Name: blockReader::begin
+// Description: This function returns an iterator at the next byte not yet read, or end() if there is none.
+blockReader::iterator blockReader::begin()
+{
+	return iterator{ stream.outputPosition < stream.output.size() || nextBlock() ? this : nullptr };
+}
+
+// Function Name: blockReader::end
+// Description: This function returns the iterator every other one equals once the data runs out.
+blockReader::iterator blockReader::end()
+{
+	return iterator{ nullptr };
+}
+
+// Function Name: blockReader::iterator::operator++
+// Description: This function moves on a byte, decoding the next block at the end of this one.
+blockReader::iterator& blockReader::iterator::operator++()
+{
+	if (++reader->stream.outputPosition == reader->stream.output.size() && !reader->nextBlock())
+		reader = nullptr;
+
+	return *this;
+}
+
+// Function Name: decodeBlockFile
+// Description: This function accepts an istream positioned just after the magic number of a block format huf image. It
+// reads the file name and opens the output file with that name, or standard output if the name is "-", unless it is
+// given a destination stream to write to instead. Each block is decoded and checked against its checksum before it is
+// written and the next is read, so memory use does not grow with the file. huffFileSize is the size of the whole image,
+// INT_MAX when it is not known, and bounds the name length like loadHuffTable does. Returns false if the name length is
+// damaged, if a block can not be decoded or is damaged, if the file checksum does not match, or if the output file could
+// not be opened.
+bool decodeBlockFile(istream& fin, int huffFileSize, ostream* destination)
+{
+	int fileNameLength = 0;
+	fin.read((char*)&fileNameLength, sizeof(int));
+
+	// The magic number and the name length come before the name
+	if (!fin || fileNameLength < 0 || fileNameLength > huffFileSize - 2 * (int)sizeof(int))
+	{
+		cerr << "the file name length is damaged" << endl;
+		return false;
+	}
+
+	string fileName(fileNameLength, '\0');
+	fin.read(&fileName[0], fileNameLength);
+
+	ofstream fileOut;
+	if (fin && !testOnly && destination == nullptr && fileName != "-")
+		openOutputFile(fileName, fileOut);
+
+	discardBuffer discarded;
+	ostream discardOut(&discarded);
+	ostream& fout = testOnly ? discardOut : destination != nullptr ? *destination : fileName == "-" ? cout : fileOut;
+
+	if (!fin || !fout)
+		return false;
+
+	string output;
+	vector<unsigned char> payload;
+	blockContext context;
+	vector<pendingBlock> bwtBatch;
+	int batchSize = max(1, (int)taskPool.queues.size());
+	bool decoded = true;
+	int blockNumber = 0;
+	long long storedBytes = 0;
+	unsigned int fileCrc = CRCINITIAL;
+
+	context.fileName = fileName;
+
+	while (decoded)
+	{
+		int blockType = BLOCK_END;
+		int rawLength = 0;
+		unsigned int checksum = 0;
+
+		decoded = readBlock(fin, blockNumber, blockType, rawLength, checksum, payload);
+
+		if (!decoded || blockType == BLOCK_END)
+			break;
+
+		storedBytes += rawLength;
+
+		// Consecutive BWT blocks are gathered and decoded in parallel, and written before any later block
+		if (blockType == BLOCK_BWT)
+		{
+			bwtBatch.push_back(pendingBlock{ rawLength, checksum, payload, string(), false });
+
+			if ((int)bwtBatch.size() >= batchSize)
+				decoded = decodeBwtBatch(bwtBatch, fout, blockNumber + 1 - (int)bwtBatch.size(), fileCrc);
+
+			blockNumber++;
+			continue;
+		}
+
+		if (!bwtBatch.empty() && !decodeBwtBatch(bwtBatch, fout, blockNumber - (int)bwtBatch.size(), fileCrc))
+		{
+			decoded = false;
+			break;
+		}
+
+		if (!decodeBlock(context, blockType, payload.data(), (int)payload.size(), rawLength, output))
+		{
+			cerr << "block " << blockNumber << " can not be decoded" << endl;
+			decoded = false;
+			break;
+		}
+
+		// Damaged data is never written, so the output only ever holds blocks that passed their checksum
+		if ((int)output.size() != rawLength || ~updateCrc(CRCINITIAL, output.data(), output.size()) != checksum)
+		{
+			cerr << "block " << blockNumber << " is damaged" << endl;
+			decoded = false;
+			break;
+		}
+
+		fileCrc = updateCrc(fileCrc, output.data(), output.size());
+		fout.write(output.data(), output.size());
+		fout.flush();
+
+		blockNumber++;
+	}
+
+	if (decoded && !bwtBatch.empty())
+		decoded = decodeBwtBatch(bwtBatch, fout, blockNumber - (int)bwtBatch.size(), fileCrc);
+
+	unsigned int fileChecksum = 0;
+
+	if (decoded && fin)
+	{
+		fin.read((char*)&fileChecksum, sizeof(int));
+
+		if (!fin || ~fileCrc != fileChecksum)
+		{
+			cerr << fileName << " does not match its file checksum" << endl;
+			decoded = false;
+		}
+	}
+
+	if (testOnly && decoded && discarded.byteCount != storedBytes)
+	{
+		cerr << fileName << " decoded to " << discarded.byteCount << " bytes instead of " << storedBytes << endl;
+		decoded = false;
+	}
+
+	testedBytes += discarded.byteCount;
+
+	return decoded && fin && fout;
+}
+
+// Function Name: decodeHufFile
+// Description: This function accepts an istream positioned at the start of a huf image and the size of that image in bytes.
+// It reads the header, huffman table and file data, then decodes the data into a file named by the title in the header,
+// or into destination if it is not nullptr. The image may be a whole huf file or one entry of an archive, in either the
+// single table or the block format. Returns false if the image could not be decoded or the output file could not be
+// opened.
+bool decodeHufFile(istream& fin, int huffFileSize, ostream* destination)
+{
+	int huffDataSize = 0;
+	int fileNameLength = 0;
+	bool decoded = false;
+	string fileName;
+	vector<huffEntry> huffTree;
+
+	// Reads in the file name length from the huf image and uses it
+	// to read the file name and huffman table
+	fin.read((char*)&fileNameLength, sizeof(int));
+
+	if (fileNameLength == BLOCK_FILE_MAGIC)
+		return decodeBlockFile(fin, huffFileSize, destination);
+
+	if (!loadHuffTable(fin, huffFileSize, fileNameLength, fileName, huffTree, huffDataSize))
+	{
+		cerr << "the huffman table is malformed" << endl;
+		return false;
+	}
+
+	//Gets the size of the file data in bits from the huff image to create a string of bits
+	// from the file data
+	int huffDataBitSize = huffDataSize * BYTESIZE;
+	int* bitString = new int[huffDataBitSize];
+
+	readFileInfo(fin, huffDataSize, huffTree.data(), bitString);
+
+	if (testOnly || destination != nullptr)
+	{
+		// This format has no checksum, so the data must at least run to the end of file glyph
+		discardBuffer discarded;
+		ostream discardOut(&discarded);
+
+		decoded = writeBitString(testOnly ? discardOut : *destination, huffTree.data(), bitString, huffDataBitSize);
+		testedBytes += discarded.byteCount;
+
+		if (!decoded)
+			cerr << fileName << " ends before its end of file code" << endl;
+
+		delete[] bitString;
+
+		return decoded;
+	}
+
+	// Uses the file name from the header to create an output file
+	ofstream fout;
+	openOutputFile(fileName, fout);
+
+	if (fout)
+	{
+		writeBitString(fout, huffTree.data(), bitString, huffDataBitSize);
+		fout.close();
+		decoded = true;
+	}
+
+	delete[] bitString;
+
+	return decoded;
+}
+
+// Function Name: getBlockTableSize
+// Description: This function returns how many bytes at the start of a block's payload hold its table, for the huffman,
+// huffman patch and order-1 blocks that carry one. previousLengths holds the code lengths a patch is applied to. Returns
+// 0 for a block with no table or one that can not be read.
+int getBlockTableSize(int blockType, const unsigned char* payload, int payloadLength, const unsigned char* previousLengths)
+{
+	unsigned char codeLengths[MAXGLYPHS];
+	int position = 0;
+	int tableCount = 0;
+
+	if (blockType == BLOCK_HUFFMAN)
+		return readCompactCodeLengths(payload, payloadLength, position, codeLengths, BYTEGLYPHS) ? position : 0;
+
+	if (blockType == BLOCK_HUFFMAN_PATCH)
+	{
+		memcpy(codeLengths, previousLengths, MAXGLYPHS);
+		return readCodeLengthChanges(payload, payloadLength, position, codeLengths) ? position : 0;
+	}
+
+	if (blockType != BLOCK_ORDER1 || payloadLength < (int)sizeof(int))
+		return 0;
+
+	memcpy(&tableCount, payload, sizeof(int));
+
+	if (tableCount < 0 || tableCount > ORDER1CONTEXTS + 1)
+		return 0;
+
+	position = sizeof(int) + (tableCount > 1 ? ORDER1CONTEXTS : 0);
+
+	for (int t = 0; t < tableCount; t++)
+		if (!readCompactCodeLengths(payload, payloadLength, position, codeLengths, BYTEGLYPHS))
+			return 0;
+
+	return position;
+}
+
+// Function Name: fuzzBlockFile
+// Description: This function is fuzzHufFile for a block format huf image, with fin positioned just after the magic
+// number. The blocks are read and decoded once, keeping the huffman table each one starts from. Each damaged copy then
+// flips bits in the table of one huffman, huffman patch or order-1 block and decodes it into memory from the table it
+// started from, followed by the reuse and patch blocks that build on its table. A table that gets through
+// buildTreeFromCodeLengths is decoded without any checks, so a crash here means it let something through. Returns
+// false if no block carries a table.
+bool fuzzBlockFile(istream& fin, int iterations)
+{
+	int fileNameLength = 0;
+	fin.read((char*)&fileNameLength, sizeof(int));
+
+	if (!fin || fileNameLength < 0)
+		return false;
+
+	fin.ignore(fileNameLength);
+
+	vector<fuzzBlock> blocks;
+	vector<int> tableBlocks;
+	blockContext context;
+	string output;
+
+	while (true)
+	{
+		fuzzBlock block;
+		unsigned int checksum = 0;
+
+		if (!readBlock(fin, (int)blocks.size(), block.blockType, block.rawLength, checksum, block.payload) || block.blockType == BLOCK_END)
+			break;
+
+		block.previousLengths.assign(context.huffmanLengths, context.huffmanLengths + MAXGLYPHS);
+		block.tableSize = getBlockTableSize(block.blockType, block.payload.data(), (int)block.payload.size(), context.huffmanLengths);
+
+		if (block.tableSize > 0)
+			tableBlocks.push_back((int)blocks.size());
+
+		decodeBlock(context, block.blockType, block.payload.data(), (int)block.payload.size(), block.rawLength, output);
+		blocks.push_back(move(block));
+	}
+
+	if (tableBlocks.empty())
+		return false;
+
+	int rejected = 0;
+	mt19937 random(iterations);
+
+	for (int i = 0; i < iterations; i++)
+	{
+		int b = tableBlocks[random() % tableBlocks.size()];
+		vector<unsigned char> damaged = blocks[b].payload;
+		int flips = 1 + random() % 4;
+
+		for (int f = 0; f < flips; f++)
+			damaged[random() % blocks[b].tableSize] ^= 1 << (random() % BYTESIZE);
+
+		blockContext damagedContext;
+		memcpy(damagedContext.huffmanLengths, blocks[b].previousLengths.data(), MAXGLYPHS);
+
+		if (blocks[b].blockType == BLOCK_HUFFMAN_PATCH)
+			buildTreeFromCodeLengths(damagedContext.huffmanLengths, damagedContext.huffmanTree);
+
+		if (!decodeBlock(damagedContext, blocks[b].blockType, damaged.data(), (int)damaged.size(), blocks[b].rawLength, output))
+		{
+			rejected++;
+			continue;
+		}
+
+		for (int next = b + 1; next < (int)blocks.size() && blocks[b].blockType != BLOCK_ORDER1; next++)
+		{
+			const fuzzBlock& block = blocks[next];
+
+			if (block.blockType != BLOCK_HUFFMAN_REUSE && block.blockType != BLOCK_HUFFMAN_PATCH)
+				break;
+
+			if (!decodeBlock(damagedContext, block.blockType, block.payload.data(), (int)block.payload.size(), block.rawLength, output))
+				break;
+		}
+	}
+
+	cout << iterations << " damaged tables in " << tableBlocks.size() << " blocks, " << rejected << " rejected when decoded and "
+		<< iterations - rejected << " decoded" << endl;
+
+	return true;
+}
+
+// Function Name: fuzzHufFile
+// Description: This function checks that malformed tables are caught when they are loaded. It flips random bits in the
+// header and table of a single table huf file, then loads each damaged copy with loadHuffTable and decodes the ones
+// that pass into memory with writeBitString. A table that gets through loading must decode without any checks, so a
+// crash here means validateHuffTable let something through. Block format files are handed to fuzzBlockFile. Returns
+// false if the file has no table to damage.
+bool fuzzHufFile(string& filename, int iterations)
+{
+	ifstream fin(filename, ios::in | ios::binary);
+	stringstream original;
+	original << fin.rdbuf();
+
+	string image = original.str();
+	string fileName;
+	vector<huffEntry> huffTree;
+	int huffDataSize = 0;
+	int fileNameLength = 0;
+
+	original.read((char*)&fileNameLength, sizeof(int));
+
+	if (fileNameLength == BLOCK_FILE_MAGIC)
+		return fuzzBlockFile(original, iterations);
+
+	if (!loadHuffTable(original, (int)image.size(), fileNameLength, fileName, huffTree, huffDataSize))
+		return false;
+
+	int tableEnd = (int)image.size() - huffDataSize;
+	int rejected = 0;
+	mt19937 random(iterations);
+
+	for (int i = 0; i < iterations; i++)
+	{
+		string damaged = image;
+		int flips = 1 + random() % 4;
+
+		for (int f = 0; f < flips; f++)
+			damaged[random() % tableEnd] ^= 1 << (random() % BYTESIZE);
+
+		istringstream damagedIn(damaged);
+		damagedIn.read((char*)&fileNameLength, sizeof(int));
+
+		if (!loadHuffTable(damagedIn, (int)damaged.size(), fileNameLength, fileName, huffTree, huffDataSize))
+		{
+			rejected++;
+			continue;
+		}
+
+		int huffDataBitSize = huffDataSize * BYTESIZE;
+		int* bitString = new int[huffDataBitSize];
+		ostringstream decodedOut;
+
+		readFileInfo(damagedIn, huffDataSize, huffTree.data(), bitString);
+		writeBitString(decodedOut, huffTree.data(), bitString, huffDataBitSize);
+
+		delete[] bitString;
+	}
+
+	cout << iterations << " damaged tables, " << rejected << " rejected when loaded and " << iterations - rejected << " decoded" << endl;
+
+	return true;
+}
+
+// Function Name: readArchiveDirectory
+// Description: This function reads the footer at the end of an archive and then the central directory it points to,
+// storing every entry's name, sizes and offset. None of the entries themselves are read, so listing is immediate. Every
+// count, length and offset is checked against the size of the archive before it is used, and each entry must lie
+// between the magic number and the directory. Returns false if the footer does not carry the archive magic number or
+// the directory does not fit the archive.
+bool readArchiveDirectory(ifstream& fin, vector<archiveEntry>& directory)
+{
+	const long long entryHeaderSize = 3 * sizeof(int) + sizeof(long long);
+	long long directoryOffset = 0;
+	int entryCount = 0;
+	int magic = 0;
+
+	fin.seekg(0, ios::end);
+	long long fileSize = (long long)fin.tellg();
+
+	if (!fin || fileSize < (long long)sizeof(int) + archiveFooterSize)
+		return false;
+
+	long long directoryEnd = fileSize - archiveFooterSize;
+
+	fin.seekg(directoryEnd, ios::beg);
+	fin.read((char*)&directoryOffset, sizeof(long long));
+	fin.read((char*)&entryCount, sizeof(int));
+	fin.read((char*)&magic, sizeof(int));
+
+	if (!fin || magic != ARCHIVE_MAGIC || directoryOffset < (long long)sizeof(int) || directoryOffset > directoryEnd
+		|| entryCount < 0 || entryCount > (directoryEnd - directoryOffset) / entryHeaderSize)
+	{
+		return false;
+	}
+
+	fin.seekg(directoryOffset, ios::beg);
+	directory.resize(entryCount);
+
+	for (int i = 0; i < entryCount; i++)
+	{
+		int nameLength = 0;
+		fin.read((char*)&nameLength, sizeof(int));
+
+		if (!fin || nameLength < 0 || nameLength > directoryEnd - (long long)fin.tellg() - (entryHeaderSize - (long long)sizeof(int)))
+			return false;
+
+		directory[i].name.resize(nameLength);
+		fin.read(&directory[i].name[0], nameLength);
+		fin.read((char*)&directory[i].originalSize, sizeof(int));
+		fin.read((char*)&directory[i].compressedSize, sizeof(int));
+		fin.read((char*)&directory[i].offset, sizeof(long long));
+
+		// extractArchive seeks straight to the entry, so it must be inside the archive
+		if (!fin || directory[i].compressedSize < 0 || directory[i].offset < (long long)sizeof(int)
+			|| directory[i].offset > directoryOffset - directory[i].compressedSize)
+			return false;
+	}
+
+	return (bool)fin;
+}
+
+// Function Name: listArchive
+// Description: This function prints the name, original size and compressed size of each entry in the directory.
+void listArchive(vector<archiveEntry>& directory)
+{
+	for (int i = 0; i < (int)directory.size(); i++)
+	{
+		cout << setw(12) << directory[i].originalSize << " " << setw(12) << directory[i].compressedSize << " " << directory[i].name << endl;
+	}
+	cout << directory.size() << " entries" << endl;
+}
+
+// Function Name: extractArchive
+// Description: This function extracts the entries of an archive. If names is empty every entry is extracted, otherwise only
+// the entries with a matching name. Each entry is a task in the pool with its own stream on the archive. Returns the number
+// of entries that failed.
+int extractArchive(string& archiveName, vector<archiveEntry>& directory, vector<string>& names)
+{
+	vector<archiveEntry*> selected;
+
+	for (int i = 0; i < (int)directory.size(); i++)
+	{
+		if (names.empty() || find(names.begin(), names.end(), directory[i].name) != names.end())
+			selected.push_back(&directory[i]);
+	}
+
+	atomic<int> remainingEntries((int)selected.size());
+	atomic<int> failures(0);
+
+	for (int i = (int)selected.size() - 1; i >= 0; i--)
+	{
+		submitPoolTask([&, i]()
+		{
+			ifstream fin(archiveName, ios::in | ios::binary);
+			fin.seekg(selected[i]->offset, ios::beg);
+
+			if (!fin || !decodeHufFile(fin, selected[i]->compressedSize, nullptr))
+				failures++;
+
+			remainingEntries--;
+		});
+	}
+
+	waitForPoolTasks(remainingEntries);
+
+	return failures;
+}
+
+// Function Name: decodeDirectory
+// Description: This function decodes every huf file under a directory, searching it recursively, with one pool task per
+// file. Each file is written to the name stored in it, so a tree compressed with huff comes back where it was. Returns the
+// number of files that failed.
+int decodeDirectory(string& directoryName)
+{
+	vector<string> fileNames;
+	error_code error;
+
+	for (filesystem::recursive_directory_iterator entry(directoryName, error), end; !error && entry != end; entry.increment(error))
+	{
+		if (entry->is_regular_file(error) && entry->path().extension() == ".huf")
+			fileNames.push_back(entry->path().string());
+	}
+
+	atomic<int> remainingFiles((int)fileNames.size());
+	atomic<int> failures(error ? 1 : 0);
+
+	for (int i = (int)fileNames.size() - 1; i >= 0; i--)
+	{
+		submitPoolTask([&, i]()
+		{
+			ifstream fin(fileNames[i], ios::in | ios::binary);
+			fin.seekg(0, ios::end);
+			int huffFileSize = (int)fin.tellg();
+			fin.seekg(0, ios::beg);
+
+			if (!fin || !decodeHufFile(fin, huffFileSize, nullptr))
+			{
+				cerr << "unable to decode " + fileNames[i] + "\n";
+				failures++;
+			}
+
+			remainingFiles--;
+		});
+	}
+
+	waitForPoolTasks(remainingFiles);
+
+	return failures;
+}
+
+// Usage: Puff [--dictionary dictionary] [file | -]
+//        Puff --list archive
+//        Puff [--dictionary dictionary] --extract archive [-j threads] [entry names...]
+// With no file the program asks for the file to decompress. A plain file argument may be a huf file or an archive,
+// in which case every entry is extracted. A file of - decodes a block format stream from standard input. --dictionary
+// may be given more than once. Files are written below the current directory, and a stored name with a root or a ".."
+// is refused.
+#ifndef _WIN32
+// Set by the signal handler to stop --serve.
+volatile sig_atomic_t stopServing = 0;
+
+// Function Name: requestStop
+// Description: This function is the signal handler that asks the daemon to stop once its poll returns.
+void requestStop(int)
+{
+	stopServing = 1;
+}
+
+// Function Name: transferFully
+// Description: This function reads or writes exactly length bytes on a socket, carrying on after short transfers and
+// interrupted calls. Returns false if the peer closed the socket or it failed.
+bool transferFully(int socketDescriptor, char* data, size_t length, bool isWrite)
+{
+	while (length > 0)
+	{
+		ssize_t transferred = isWrite ? send(socketDescriptor, data, length, 0) : recv(socketDescriptor, data, length, 0);
+
+		if (transferred < 0 && errno == EINTR)
+			continue;
+
+		if (transferred <= 0)
+			return false;
+
+		data += transferred;
+		length -= transferred;
+	}
+
+	return true;
+}
+
+// Function Name: recordLatency
+// Description: This function adds one request's time in microseconds to a latency histogram.
+void recordLatency(latencyHistogram& histogram, long long microseconds)
+{
+	int bucket = 0;
+
+	while (bucket < LATENCYBUCKETS - 1 && (1LL << bucket) <= microseconds)
+		bucket++;
+
+	histogram.buckets[bucket]++;
+	histogram.requests++;
+	histogram.totalMicroseconds += microseconds;
+}
+
+// Function Name: printLatencyHistograms
+// Description: This function writes the request count, mean latency and non-empty buckets of every request type served.
+void printLatencyHistograms(ostream& out, latencyHistogram* histograms)
+{
+	for (int type = 0; type < REQUEST_TYPES; type++)
+	{
+		long long requests = histograms[type].requests;
+
+		if (requests == 0)
+			continue;
+
+		out << REQUEST_NAMES[type] << ": " << requests << " requests, mean " << histograms[type].totalMicroseconds / requests << " us" << endl;
+
+		for (int bucket = 0; bucket < LATENCYBUCKETS; bucket++)
+		{
+			if (histograms[type].buckets[bucket] > 0)
+				out << "\t< " << (1LL << bucket) << " us: " << histograms[type].buckets[bucket] << endl;
+		}
+	}
+}
+
+// Function Name: serveRequests
+// Description: This function runs Puff as a daemon on a UNIX domain socket until SIGINT or SIGTERM. The main thread polls
+// the listening socket and every idle connection, and each request that arrives becomes a task in the pool, which reads
+// the huf image, decodes it into a buffer kept by the worker and writes the response before handing the connection back
+// to be polled. Images are decoded with every check a file gets, and references and dictionaries loaded on the command
+// line stay loaded. With one thread the main thread runs the requests itself. Returns false if the socket could not be
+// created.
+bool serveRequests(string& socketPath)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+
+	if (socketPath.size() >= sizeof(address.sun_path))
+		return false;
+
+	strcpy(address.sun_path, socketPath.c_str());
+
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	int wakePipe[2];
+
+	unlink(socketPath.c_str());
+
+	if (listenSocket < 0 || bind(listenSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenSocket, SOMAXCONN) != 0 || pipe(wakePipe) != 0)
+		return false;
+
+	// No SA_RESTART, so a signal interrupts poll
+	struct sigaction stopAction = {};
+	stopAction.sa_handler = requestStop;
+	sigaction(SIGINT, &stopAction, nullptr);
+	sigaction(SIGTERM, &stopAction, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	latencyHistogram histograms[REQUEST_TYPES] = {};
+	vector<int> idleConnections;
+	vector<int> returnedConnections;
+	mutex returnLock;
+	atomic<int> busyConnections(0);
+
+	auto handleRequest = [&](int connection)
+	{
+		thread_local vector<char> request;
+		thread_local vector<char> response;
+
+		int header[2] = { 0, 0 };
+		bool keepOpen = transferFully(connection, (char*)header, sizeof(header), false) && header[1] >= 0 && header[1] <= MAXREQUESTLENGTH;
+
+		if (keepOpen)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			int requestType = header[0] > 0 && header[0] < REQUEST_TYPES ? header[0] : 0;
+			int status = RESPONSE_OK;
+
+			request.resize(header[1]);
+			response.clear();
+			keepOpen = transferFully(connection, request.data(), request.size(), false);
+
+			vectorBuffer responseBuffer(&response);
+			ostream responseOut(&responseBuffer);
+
+			if (requestType == REQUEST_DECOMPRESS)
+			{
+				memoryBuffer requestBuffer(request.data(), request.size());
+				istream requestIn(&requestBuffer);
+
+				if (!decodeHufFile(requestIn, (int)request.size(), &responseOut))
+				{
+					response.clear();
+					responseOut << "the huf image is damaged or needs a reference or dictionary that is not loaded";
+					status = RESPONSE_ERROR;
+				}
+			}
+
+			else if (requestType == REQUEST_STATS)
+				printLatencyHistograms(responseOut, histograms);
+
+			else
+			{
+				responseOut << "Puff only serves decompress and stats requests";
+				status = RESPONSE_ERROR;
+			}
+
+			int responseHeader[2] = { status, (int)response.size() };
+
+			keepOpen = keepOpen && transferFully(connection, (char*)responseHeader, sizeof(responseHeader), true)
+				&& transferFully(connection, response.data(), response.size(), true);
+
+			recordLatency(histograms[requestType], chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+		}
+
+		if (keepOpen)
+		{
+			lock_guard<mutex> guard(returnLock);
+			returnedConnections.push_back(connection);
+		}
+
+		else
+			close(connection);
+
+		busyConnections--;
+
+		char wake = 0;
+		write(wakePipe[1], &wake, 1);
+	};
+
+	while (!stopServing)
+	{
+		vector<pollfd> pollDescriptors = { { listenSocket, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+
+		for (int i = 0; i < (int)idleConnections.size(); i++)
+			pollDescriptors.push_back({ idleConnections[i], POLLIN, 0 });
+
+		if (poll(pollDescriptors.data(), pollDescriptors.size(), -1) < 0)
+			continue;
+
+		vector<int> stillIdle;
+
+		for (int i = 2; i < (int)pollDescriptors.size(); i++)
+		{
+			int connection = pollDescriptors[i].fd;
+
+			if (pollDescriptors[i].revents == 0)
+				stillIdle.push_back(connection);
+
+			else
+			{
+				busyConnections++;
+				submitPoolTask([&handleRequest, connection]() { handleRequest(connection); });
+			}
+		}
+
+		idleConnections.swap(stillIdle);
+
+		if (pollDescriptors[1].revents != 0)
+		{
+			char drain[256];
+			read(wakePipe[0], drain, sizeof(drain));
+
+			lock_guard<mutex> guard(returnLock);
+			idleConnections.insert(idleConnections.end(), returnedConnections.begin(), returnedConnections.end());
+			returnedConnections.clear();
+		}
+
+		if (pollDescriptors[0].revents != 0)
+		{
+			int connection = accept(listenSocket, nullptr, nullptr);
+
+			if (connection >= 0)
+				idleConnections.push_back(connection);
+		}
+
+		if (taskPool.workers.empty())
+		{
+			while (runPoolTask());
+		}
+	}
+
+	// Requests already being served are finished before the daemon stops
+	waitForPoolTasks(busyConnections);
+
+	idleConnections.insert(idleConnections.end(), returnedConnections.begin(), returnedConnections.end());
+
+	for (int i = 0; i < (int)idleConnections.size(); i++)
+		close(idleConnections[i]);
+
+	close(listenSocket);
+	close(wakePipe[0]);
+	close(wakePipe[1]);
+	unlink(socketPath.c_str());
+
+	printLatencyHistograms(cout, histograms);
+
+	return true;
+}
+#endif
+
+// Function Name: reportTestThroughput
+// Description: This function prints how much --test decoded and how fast, timed by the wall clock since all of the
+// pool's threads decode at once.
+void reportTestThroughput(ostream& out, chrono::steady_clock::time_point start)
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	double megabytes = testedBytes / (1024.0 * 1024.0);
+
+	out << "Tested " << testedBytes << " bytes in " << seconds << " seconds";
+
+	if (seconds > 0)
+		out << ", " << megabytes / seconds << " MiB/s";
+
+	out << ", no errors found" << endl;
+}
+
+int main(int argc, char* argv[])
+{
 	int huffFileSize = 0;
-	int huffDataSize = 0;
-	int fileNameLength = 0;
-	int huffHeaderSize = 0;
+	int threadCount = thread::hardware_concurrency();
+	bool listOnly = false;
+	bool catMode = false;
+	int fuzzIterations = 0;
+	string socketPath;
+	vector<string> entryNames;
 
 	string filename;
-	cout << "What is the file you would like to decompress? ";
-	cin >> filename;
+	string option;
+
+	detectCpuFeatures();
+	initializeCrc();
+
+	for (int i = 1; i < argc; i++)
+	{
+		string argument = argv[i];
+
+		if (argument == "--list" || argument == "--extract")
+		{
+			option = argument;
+			listOnly = argument == "--list";
+		}
+
+		else if (argument == "-j" && i + 1 < argc)
+			threadCount = atoi(argv[++i]);
+
+		else if (argument == "--test")
+			testOnly = true;
+
+		else if (argument == "--single-symbol")
+			multiSymbolTables = false;
+
+		else if (argument == "--cat")
+			catMode = true;
+
+		else if (argument == "--serve" && i + 1 < argc)
+			socketPath = argv[++i];
+
+		else if (argument == "--fuzz" && i + 1 < argc)
+			fuzzIterations = atoi(argv[++i]);
+
+		else if (argument == "--kernel" && i + 1 < argc)
+		{
+			string kernelName = argv[++i];
+			int kernel = (int)(find(KERNELNAMES, KERNELNAMES + KERNELCOUNT, kernelName) - KERNELNAMES);
+
+			if (kernel == KERNELCOUNT || (kernel == KERNELBMI2 && !cpuHasBmi2))
+			{
+				cout << "the " << kernelName << " kernel is not available on this processor...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
+
+			decoderKernel = kernel;
+		}
+
+		else if (argument == "--reference" && i + 1 < argc)
+		{
+			string referenceName = argv[++i];
+
+			if (!loadReference(referenceName))
+			{
+				cout << "unable to read reference " << referenceName << "...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		else if (argument == "--dictionary" && i + 1 < argc)
+		{
+			string dictionaryName = argv[++i];
+
+			if (!loadDictionary(dictionaryName))
+			{
+				cout << "unable to read dictionary " << dictionaryName << "...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		else if (filename.empty())
+			filename = argument;
+
+		else
+			entryNames.push_back(argument);
+	}
+
+	if (filename.empty() && socketPath.empty())
+	{
+		if (!option.empty())
+		{
+			cout << "usage: Puff " << option << " archive [-j threads] [entry names...]" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		cout << "What is the file you would like to decompress? ";
+		cin >> filename;
+	}
 
 	clock_t begin = clock();
+	chrono::steady_clock::time_point testStart = chrono::steady_clock::now();
 
-	ifstream fin(filename, ios::in | ios::binary);
+	startTaskPool(max(1, threadCount));
+	atexit(stopTaskPool);
 
-	if (fin)
+	if (!socketPath.empty())
+	{
+#ifdef _WIN32
+		cout << "--serve needs UNIX domain sockets, which this build does not support...program exiting" << endl;
+		exit(EXIT_FAILURE);
+#else
+		if (!serveRequests(socketPath))
+		{
+			cout << "unable to listen on " << socketPath << "...program exiting" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		return 0;
+#endif
+	}
+
+	if (fuzzIterations > 0)
 	{
-		// Gets the huf file size
-		fin.seekg(0, ios::end);
-		huffFileSize = fin.tellg();
-		fin.seekg(0, ios::beg);
+		if (!fuzzHufFile(filename, fuzzIterations))
+		{
+			cout << "--fuzz needs a huf file with a huffman or order-1 table...program exiting" << endl;
+			exit(EXIT_FAILURE);
+		}
 
-		// Reads in the file name length from the huf file and uses it
-		// to create an array of unsigned chars for the file name
-		fin.read((char*)&fileNameLength, sizeof(int));
-		unsigned char* compressedFile = new unsigned char[fileNameLength];
+		return 0;
+	}
 
-		readHeader(fin, huffTableEntries, fileNameLength, compressedFile);
+	if (catMode)
+	{
+		// The data goes to standard output a chunk at a time as blockReader decodes it, without any output file
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		ifstream fileIn;
+		if (filename != "-")
+			fileIn.open(filename, ios::in | ios::binary);
 
-		// Created to store the huffman table
-		huffEntry* huffTree = new huffEntry[huffTableEntries];
+		istream& fin = filename == "-" ? cin : fileIn;
+		blockReader reader(fin);
+		vector<char> chunk(CATCHUNKSIZE);
+		size_t chunkLength = 0;
 
-		//Gets the size of the file data in bits from the huff file to create a string of bits
-		// from the file data
-		huffHeaderSize = fileNameLength + BYTESIZE;
-		huffTableByteSize = huffEntrySize * huffTableEntries;
-		huffDataSize = huffFileSize - ((huffTableEntries * huffEntrySize) + huffHeaderSize);
-		int huffDataBitSize = huffDataSize * BYTESIZE;
-		int* bitString = new int[huffDataBitSize];
+		while ((chunkLength = reader.read(chunk.data(), chunk.size())) > 0)
+			cout.write(chunk.data(), chunkLength);
+
+		cout.flush();
+
+		if (reader.stream.failed || !cout)
+		{
+			cerr << "unable to decode " << filename << "...program exiting" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		return 0;
+	}
+
+	if (filename == "-")
+	{
+		// A block format stream on standard input, such as one from huff --adaptive -, is decoded as it arrives
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		int magic = 0;
+		cin.read((char*)&magic, sizeof(int));
+
+		if (magic != BLOCK_FILE_MAGIC || !decodeBlockFile(cin, INT_MAX, nullptr))
+		{
+			cerr << "unable to decode standard input...program exiting" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		if (testOnly)
+			reportTestThroughput(cerr, testStart);
+
+		clock_t end = clock();
+		cerr << "Time elapsed: " << double(end - begin) / CLOCKS_PER_SEC << endl;
+		return 0;
+	}
+
+	error_code error;
+
+	if (filesystem::is_directory(filename, error))
+	{
+		if (decodeDirectory(filename) > 0)
+		{
+			cout << "unable to decode every file...program exiting" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		if (testOnly)
+			reportTestThroughput(cout, testStart);
+
+		clock_t end = clock();
+		cout << "Time elapsed: " << double(end - begin) / CLOCKS_PER_SEC << endl;
+		return 0;
+	}
 
-		readHuffTable(fin, huffTableEntries, huffTree);
-		readFileInfo(fin, huffDataSize, huffTree, bitString);
+	ifstream fin(filename, ios::in | ios::binary);
 
-		// Converts the file name to a string to use it in creating an output file
-		string fileName(reinterpret_cast<char*>(compressedFile));
-		ofstream fout(fileName, ios::binary | ios::out);
+	if (fin)
+	{
+		int magic = 0;
+		fin.read((char*)&magic, sizeof(int));
 
-		if (fout)
+		if (magic == ARCHIVE_MAGIC)
 		{
-			writeBitString(fout, huffTree, bitString, huffDataBitSize);
+			vector<archiveEntry> directory;
+
+			if (!readArchiveDirectory(fin, directory))
+			{
+				cout << "archive directory is damaged...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
 
-			fout.close();
 			fin.close();
-			delete[huffTableEntries] huffTree;
-			delete[huffDataBitSize] bitString;
+
+			if (listOnly)
+				listArchive(directory);
+
+			else if (extractArchive(filename, directory, entryNames) > 0)
+			{
+				cout << "unable to extract every entry...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
 		}
 
-		else
+		else if (listOnly || option == "--extract")
 		{
-			cout << "unable to open output file...program exiting" << endl;
+			cout << "not an archive...program exiting" << endl;
 			exit(EXIT_FAILURE);
 		}
+
+		else
+		{
+			// Gets the huf file size
+			fin.seekg(0, ios::end);
+			huffFileSize = fin.tellg();
+			fin.seekg(0, ios::beg);
+
+			if (!decodeHufFile(fin, huffFileSize, nullptr))
+			{
+				cout << "unable to decode file...program exiting" << endl;
+				exit(EXIT_FAILURE);
+			}
+
+			fin.close();
+		}
 	}
 
 	else
@@ -195,6 +3469,9 @@ int main()
 		exit(EXIT_FAILURE);
 	}
 
+	if (testOnly && !listOnly)
+		reportTestThroughput(cout, testStart);
+
 	clock_t end = clock();
 	double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
 	cout << "Time elapsed: " << elapsed_secs << endl;
@@ -10,17 +10,71 @@
 ******************************************************************************/
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <ctime>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HUFF_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HUFF_TARGET_SSE42
+#else
+#include <cpuid.h>
+#define HUFF_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+// The BMI2 kernels are written once as portable code and compiled again
+// inside functions that enable the instructions, so gcc and clang pick shlx
+// and shrx themselves. MSVC has no per function targets, so its BMI2 bit
+// operations use the intrinsics directly
+#if defined(_M_X64) || defined(__x86_64__)
+#define HUFF_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define HUFF_TARGET_BMI2
+#else
+#define HUFF_TARGET_BMI2 __attribute__((target("bmi2"), flatten))
+#endif
+#endif
+
 using namespace std;
 
 const int MAX_GLYPHS = 257;
 const int EOF_GLYPH = 256;
+const int BYTE_GLYPHS = 256;
 
 const int MAX_HUFFMAN_NODES = 513;
 
@@ -41,396 +95,5593 @@ struct HuffmanNode {
 	int right;
 };
 
+// "HPAR" when read as bytes
+const int ARCHIVE_MAGIC = 0x52415048;
+
+// "HPF2" when read as bytes, marks a huf file made of blocks rather than a
+// single huffman table
+const int BLOCK_FILE_MAGIC = 0x32465048;
+
+const int BLOCK_END = 0;
+const int BLOCK_DICTIONARY = 1;
+const int BLOCK_ADAPTIVE = 2;
+const int BLOCK_ORDER1 = 3;
+const int BLOCK_LZ = 4;
+const int BLOCK_BWT = 5;
+const int BLOCK_HUFFMAN = 6;
+const int BLOCK_STORED = 7;
+
+// Written by --append over the end block it replaces, and followed by that
+// end block's now stale file checksum
+const int BLOCK_APPENDED = 8;
+
+// An LZ block whose matches may reach back into a reference file given to
+// both huff and Puff. The payload starts with the reference's CRC32C and
+// length so Puff can tell it has the right one
+const int BLOCK_DELTA = 9;
+
+// Huffman blocks that take the table of the huffman block before them, as
+// it is or with some code lengths changed. A patch starts with a bitmap of
+// the byte values whose lengths changed and a 4 bit new length for each
+const int BLOCK_HUFFMAN_REUSE = 10;
+const int BLOCK_HUFFMAN_PATCH = 11;
+
+// The tables of every block type store code lengths in 4 bits
+const int MAX_BLOCK_CODE_LENGTH = 15;
+
+// Every block header carries the CRC32C of the block's original data, and
+// the end block is followed by the CRC32C of the whole file
+const unsigned int CRC32C_POLYNOMIAL = 0x82F63B78u;
+const unsigned int CRC_INITIAL = 0xFFFFFFFFu;
+const int CRC_SLICES = 8;
+
+// Encoder kernels, slowest first. The best one the processor supports is used
+// unless --kernel forces another
+const int KERNEL_PORTABLE = 0;
+const int KERNEL_BMI2 = 1;
+const int KERNEL_COUNT = 2;
+const char *const KERNEL_NAMES[KERNEL_COUNT] = { "portable", "bmi2" };
+
+// Codes up to this long are packed into a 64 bit word, leaving room for the
+// 7 bits still waiting in the encoder's buffer
+const int MAX_PACKED_CODE_LENGTH = 56;
+
+// The pair table holds the codes of every two byte sequence, so it is only
+// used when each byte's code is short enough for two to share 32 bits and
+// the data is long enough to pay for filling 64K entries
+const int PAIR_TABLE_SIZE = BYTE_GLYPHS * BYTE_GLYPHS;
+const int MAX_PAIR_CODE_LENGTH = 16;
+const int PAIR_TABLE_MIN_LENGTH = 256 * 1024;
+
+const int HISTOGRAM_TABLES = 4;
+
+// --estimate reads this fraction of each file unless --sample says otherwise,
+// in chunks spread evenly through the file
+const double DEFAULT_SAMPLE_FRACTION = 0.01;
+const int SAMPLE_CHUNK_SIZE = 16 * 1024;
+
+// Files whose first bytes already look compressed, such as JPEG or gzip
+// files, are stored without coding. The order-0 entropy of the sample is
+// compared with --skip-entropy, and a threshold above 8 never skips
+const int ENTROPY_SAMPLE_SIZE = 64 * 1024;
+const double DEFAULT_SKIP_ENTROPY = 7.9;
+
+// Blocks are coded independently, so several can be compressed at once
+const int DEFAULT_BLOCK_SIZE = 1 << 20;
+const int MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Level 1 builds each block's table from chunks this long taken this far
+// apart instead of counting every byte
+const int FAST_SAMPLE_CHUNK_SIZE = 1024;
+const int FAST_SAMPLE_STRIDE = 8 * 1024;
+
+// Huffman block boundaries are chosen a segment at a time. A new block
+// costs its header, the table bitmap and a nibble per code length
+const int SPLIT_SEGMENT_SIZE = 16 * 1024;
+const int SPLIT_TASK_SEGMENTS = 64;
+const int SPLIT_BLOCK_OVERHEAD_BITS = (4 * (int)sizeof(int) + BYTE_GLYPHS / BYTE_SIZE) * BYTE_SIZE;
+const int SPLIT_CODE_LENGTH_BITS = 4;
+
+// --level trades ratio for speed, level 2 is the plain block huffman default
+const int MIN_LEVEL = 1;
+const int MAX_LEVEL = 9;
+
+// The LZ effort and window bits of levels 3 to 8. On a 26 MB mix of logs,
+// source and binaries each level is slower and smaller than the one before:
+// 0.1 s for levels 1 and 2, 0.5 s to 1.6 s for the LZ levels and 2.6 s for BWT
+const int MIN_LZ_LEVEL = 3;
+const int LZ_LEVEL_EFFORTS[] = { 2, 4, 5, 6, 7, 7 };
+const int LZ_LEVEL_WINDOW_BITS[] = { 16, 16, 16, 16, 16, 18 };
+
+// "HPDC" when read as bytes
+const int DICTIONARY_MAGIC = 0x43445048;
+
+const int MAX_CODE_LENGTH = 64;
+
+const unsigned int FNV_OFFSET_BASIS = 2166136261u;
+const unsigned int FNV_PRIME = 16777619u;
+
+struct Dictionary {
+
+	int id;
+	unsigned char codeLengths[MAX_GLYPHS];
+	string bitcodeArray[MAX_GLYPHS];
+};
+
+// An earlier revision loaded with --reference
+struct ReferenceFile {
+
+	vector<char> data;
+	unsigned int checksum;
+};
+
+// Order-1 blocks pick one of their tables by the previous byte
+const int ORDER1_MAX_CODE_LENGTH = MAX_BLOCK_CODE_LENGTH;
+const int ORDER1_CONTEXTS = 256;
+
+// The LZ stage codes a match as the spare glyph 256 in the literal table,
+// followed by a length code and a distance code from two more tables. Codes
+// above 3 carry extra bits, two codes per power of two
+const int LZ_MATCH_GLYPH = 256;
+const int LZ_MIN_MATCH = 3;
+const int LZ_MAX_MATCH = 258;
+const int LZ_LENGTH_CODES = 16;
+const int LZ_MIN_WINDOW_BITS = 10;
+const int LZ_MAX_WINDOW_BITS = 22;
+const int LZ_DISTANCE_CODES = 2 * LZ_MAX_WINDOW_BITS;
+const int LZ_MIN_HASH_BITS = 15;
+const int LZ_MAX_HASH_BITS = 20;
+const int LZ_MAX_EFFORT = 9;
+
+// How hard each effort level searches, as in zlib's configuration table. The
+// chain is searched for at most chainLength links and stops at a match of
+// niceLength. A match shorter than lazyLength is checked against the match
+// one byte later. Once a match reaches goodLength only a quarter of the chain
+// is searched, and the two searches together never walk more than chainLength
+// links. The top chains are shorter than zlib's because the window can be 128
+// times wider
+struct LzSearchLimits {
+
+	int goodLength;
+	int lazyLength;
+	int niceLength;
+	int chainLength;
+};
+
+const LzSearchLimits LZ_SEARCH_LIMITS[LZ_MAX_EFFORT + 1] = {
+	{ 0, 0, 0, 0 },
+	{ 4, 0, 8, 4 },
+	{ 4, 0, 16, 8 },
+	{ 4, 0, 32, 16 },
+	{ 4, 4, 16, 16 },
+	{ 8, 16, 32, 32 },
+	{ 8, 16, 128, 128 },
+	{ 8, 32, 128, 256 },
+	{ 32, 128, 258, 512 },
+	{ 32, 258, 258, 1024 }
+};
+
+// The BWT stage codes move-to-front indices with runs of zeros written in
+// bijective base 2 as RUNA and RUNB, and every other index moved up by one,
+// which fills the 257 glyph alphabet exactly
+const int BWT_RUN_A = 0;
+const int BWT_RUN_B = 1;
+
+struct LzToken {
+
+	int length;
+	int distance;
+	unsigned char literal;
+};
+
+// Totals reported once every file is done. Files may be compressed on
+// several threads, so the counts are atomic
+struct CompressionStats {
+
+	atomic<long long> skippedBytes{ 0 };
+	atomic<int> skippedFiles{ 0 };
+
+	// Where the cost model started each block of files with more than one
+	mutex splitLock;
+	vector<pair<string, vector<int>>> blockSplits;
+};
+
+struct CompressionOptions {
+
+	// Shared table to encode against instead of a per-file table
+	Dictionary *dictionary = nullptr;
+
+	// Code each byte with a table chosen by the byte before it
+	bool order1 = false;
+
+	// Earlier revision to encode the file as a delta against
+	ReferenceFile *reference = nullptr;
+
+	// Find repeated strings before huffman coding
+	bool lz = false;
+	int lzWindowBits = 16;
+	int lzEffort = 6;
+
+	// Burrows-Wheeler, move-to-front and zero run stages before huffman
+	// coding, run on each block in parallel
+	bool bwt = false;
+
+	// Write the original single table format instead of blocks
+	bool legacy = false;
+
+	// Build block tables from a sample so each byte is only read once
+	bool sampleHistogram = false;
+
+	// Start a new huffman block wherever the statistics change enough to
+	// pay for another table, rather than every blockSize bytes
+	bool splitBlocks = true;
+
+	int blockSize = DEFAULT_BLOCK_SIZE;
+
+	// Store files whose sample entropy in bits per byte reaches this
+	double skipEntropy = DEFAULT_SKIP_ENTROPY;
+
+	// Where skipped files are counted, if anywhere
+	CompressionStats *stats = nullptr;
+};
+
+// An incremental compressor, fed input in chunks of any size and drained of
+// output as it goes. A block is coded whenever blockSize bytes are waiting,
+// or sooner when the stream is flushed, and a huffman block may reuse the
+// table of the one before it across those calls
+struct CompressionStream {
+
+	CompressionOptions options;
+	int blockType = BLOCK_HUFFMAN;
+	vector<char> input;
+	vector<char> output;
+	size_t drainedLength = 0;
+	vector<unsigned char> carriedLengths;
+	unsigned int fileCrc = CRC_INITIAL;
+	bool finished = false;
+};
+
+// Adaptive coding only needs the 256 byte glyphs since every block stores
+// its length, so the tree has 256 leaves, 255 internal nodes and the NYT
+const int ADAPTIVE_GLYPHS = 256;
+const int MAX_ADAPTIVE_NODES = 2 * ADAPTIVE_GLYPHS + 1;
+const int ADAPTIVE_ROOT_NODE = MAX_ADAPTIVE_NODES - 1;
+
+// Once this many glyphs have been coded the model is reset at the next block
+// so the weights can never overflow and the model follows changes in the
+// stream
+const int ADAPTIVE_RESET_WEIGHT = 1 << 24;
+
+const int ADAPTIVE_CHUNK_SIZE = 64 * 1024;
+
+// Standard input is read and compressed output drained this much at a time
+const int STREAM_CHUNK_SIZE = 64 * 1024;
+
+// Node numbers are array indices, so the sibling property means weights
+// never decrease as the index increases
+struct AdaptiveNode {
+
+	int glyph;
+	int weight;
+	int parent;
+	int left;
+	int right;
+};
+
+struct AdaptiveHuffmanTree {
+
+	AdaptiveNode nodes[MAX_ADAPTIVE_NODES];
+	int leaves[ADAPTIVE_GLYPHS];
+	int notYetTransmitted;
+};
+
+struct BitWriter {
+
+	vector<unsigned char> bytes;
+	int currentBit = BYTE_SIZE;
+};
+
+// A bitcode packed with its first bit lowest, as it is written to the file
+struct PackedCode {
+
+	unsigned long long bits;
+	int length;
+};
+
+// The codes of two bytes back to back, indexed by the first byte plus 256
+// times the second
+struct PairCode {
+
+	unsigned int bits;
+	unsigned int length;
+};
+
+// Bit operations for the portable kernels
+struct PortableBitOps {
+
+	static unsigned long long shiftLeft(unsigned long long value, int count) {
+
+		return value << count;
+	}
+
+	static unsigned long long shiftRight(unsigned long long value, int count) {
+
+		return value >> count;
+	}
+};
+
+// Bit operations for the BMI2 kernels
+#if defined(HUFF_X64) && defined(_MSC_VER)
+struct Bmi2BitOps {
+
+	static unsigned long long shiftLeft(unsigned long long value, int count) {
+
+		return _shlx_u64(value, count);
+	}
+
+	static unsigned long long shiftRight(unsigned long long value, int count) {
+
+		return _shrx_u64(value, count);
+	}
+};
+#else
+struct Bmi2BitOps : PortableBitOps {};
+#endif
+
+// Slicing-by-8 tables for the software CRC32C, filled by initializeCrc
+unsigned int crcTable[CRC_SLICES][BYTE_GLYPHS];
+bool hardwareCrc = false;
+
+// Filled by detectCpuFeatures
+bool cpuHasSse42 = false;
+bool cpuHasBmi2 = false;
+
+int kernel = KERNEL_PORTABLE;
+
+struct ArchiveEntry {
+
+	string name;
+	int originalLength;
+	int compressedLength;
+	long long offset;
+};
+
+// One worker's tasks. The owner takes the newest task from the back and
+// idle workers steal the oldest from the front, so a file's block tasks
+// stay with the worker that split the file while other workers pick up
+// whole files
+struct TaskQueue {
+
+	mutex lock;
+	deque<function<void()>> tasks;
+};
+
+// Files and the blocks inside them are tasks in the same pool. The last
+// queue takes tasks submitted from outside the pool
+struct WorkStealingPool {
+
+	vector<TaskQueue> queues;
+	vector<thread> workers;
+	atomic<int> queuedTasks{ 0 };
+	atomic<bool> stopping{ false };
+	mutex sleepLock;
+	condition_variable wakeUp;
+};
+
+WorkStealingPool taskPool;
+
+// The queue owned by the current thread, or -1 outside the pool's workers
+thread_local int workerIndex = -1;
+
+// A file found on the command line or under a directory given there, with
+// the path its output takes under --output
+struct InputFile {
+
+	string path;
+	string relativePath;
+};
+
+// Requests to the --serve daemon are an int type and an int length followed
+// by that many bytes, and responses an int status and an int length
+// followed by the huf image, the stats or an error message. huff serves
+// compress requests and Puff --serve decompress requests
+const int REQUEST_COMPRESS = 1;
+const int REQUEST_DECOMPRESS = 2;
+const int REQUEST_STATS = 3;
+const int REQUEST_TYPES = 4;
+const char *const REQUEST_NAMES[REQUEST_TYPES] = { "unknown", "compress", "decompress", "stats" };
+
+const int RESPONSE_OK = 0;
+const int RESPONSE_ERROR = 1;
+
+const int MAX_REQUEST_LENGTH = 256 * 1024 * 1024;
+
+// Bucket i counts the requests that took less than 2^i microseconds
+const int LATENCY_BUCKETS = 32;
+
+struct LatencyHistogram {
+
+	atomic<long long> buckets[LATENCY_BUCKETS];
+	atomic<long long> requests;
+	atomic<long long> totalMicroseconds;
+};
+
+// A streambuf that appends to a vector it does not own, so each worker's
+// response buffer keeps its capacity from one request to the next
+struct VectorStreamBuffer : streambuf {
+
+	vector<char> *bytes;
+
+	explicit VectorStreamBuffer(vector<char> *oBytes) : bytes(oBytes) {}
+
+	int overflow(int character) override {
+
+		if (character != traits_type::eof()) {
+
+			bytes->push_back((char)character);
+		}
+
+		return traits_type::not_eof(character);
+	}
+
+	streamsize xsputn(const char *data, streamsize count) override {
+
+		bytes->insert(bytes->end(), data, data + count);
+		return count;
+	}
+};
+
 /******************************************************************************
 	Name: readFile
 
-	Des:
-		Reads a file
+	Des:
+		Reads a file
+
+	Params:
+		fileName - type string &, the name of the file
+		oDataLength - type int &, the length of the data
+
+	Returns:
+		type char *, the contents of the file
+******************************************************************************/
+char *readFile(string &fileName, int &oDataLength) {
+
+	char *result = nullptr;
+
+	ifstream fin;
+	fin.open(fileName, ios::in | ios::binary | ios::ate);
+
+	if (fin.is_open()) {
+
+		oDataLength = (int)fin.tellg();
+		fin.seekg(ios::beg);
+		result = new char[oDataLength];
+		fin.read(result, (streamsize)oDataLength);
+	}
+
+	fin.close();
+
+	return result;
+}
+
+/******************************************************************************
+	Name: detectCpuFeatures
+
+	Des:
+		Check with cpuid which of SSE4.2 and BMI2 the processor has
+******************************************************************************/
+void detectCpuFeatures() {
+
+#if defined(HUFF_X86) && defined(_MSC_VER)
+	int cpuInfo[4];
+
+	__cpuid(cpuInfo, 0);
+	int maxLeaf = cpuInfo[0];
+
+	__cpuid(cpuInfo, 1);
+	cpuHasSse42 = (cpuInfo[2] >> 20) & 1;
+
+	if (maxLeaf >= 7) {
+
+		__cpuidex(cpuInfo, 7, 0);
+		cpuHasBmi2 = (cpuInfo[1] >> 8) & 1;
+	}
+#elif defined(HUFF_X86)
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+
+		return;
+	}
+
+	cpuHasSse42 = (ecx >> 20) & 1;
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+
+		cpuHasBmi2 = (ebx >> 8) & 1;
+	}
+#endif
+
+#ifdef HUFF_X64
+	if (cpuHasBmi2) {
+
+		kernel = KERNEL_BMI2;
+	}
+#endif
+}
+
+/******************************************************************************
+	Name: isKernelSupported
+
+	Des:
+		Check whether this build and processor can run a kernel
+
+	Params:
+		kernelToCheck - type int, the kernel
+
+	Returns:
+		type bool, true if the kernel can run
+******************************************************************************/
+bool isKernelSupported(int kernelToCheck) {
+
+#ifdef HUFF_X64
+	if (kernelToCheck == KERNEL_BMI2) {
+
+		return cpuHasBmi2;
+	}
+#endif
+
+	return kernelToCheck == KERNEL_PORTABLE;
+}
+
+/******************************************************************************
+	Name: initializeCrc
+
+	Des:
+		Fill the software CRC32C tables and pick the hardware version when
+		the processor supports it
+******************************************************************************/
+void initializeCrc() {
+
+	for (int i = 0; i < BYTE_GLYPHS; i++) {
+
+		unsigned int crc = i;
+
+		for (int bit = 0; bit < BYTE_SIZE; bit++) {
+
+			crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+		}
+
+		crcTable[0][i] = crc;
+	}
+
+	for (int slice = 1; slice < CRC_SLICES; slice++) {
+
+		for (int i = 0; i < BYTE_GLYPHS; i++) {
+
+			crcTable[slice][i] = (crcTable[slice - 1][i] >> 8) ^ crcTable[0][crcTable[slice - 1][i] & 0xFF];
+		}
+	}
+
+	hardwareCrc = cpuHasSse42;
+}
+
+/******************************************************************************
+	Name: updateCrcSoftware
+
+	Des:
+		Add data to a running CRC32C eight bytes at a time with the slicing
+		tables
+
+	Params:
+		crc - type unsigned int, the running CRC
+		data - type const unsigned char *, the data
+		dataLength - type size_t, the length of the data
+
+	Returns:
+		type unsigned int, the updated running CRC
+******************************************************************************/
+unsigned int updateCrcSoftware(unsigned int crc, const unsigned char *data, size_t dataLength) {
+
+	while (dataLength >= CRC_SLICES) {
+
+		unsigned int low;
+		unsigned int high;
+
+		memcpy(&low, data, sizeof(int));
+		memcpy(&high, data + sizeof(int), sizeof(int));
+
+		low ^= crc;
+
+		crc = crcTable[7][low & 0xFF] ^ crcTable[6][(low >> 8) & 0xFF] ^ crcTable[5][(low >> 16) & 0xFF] ^ crcTable[4][low >> 24]
+			^ crcTable[3][high & 0xFF] ^ crcTable[2][(high >> 8) & 0xFF] ^ crcTable[1][(high >> 16) & 0xFF] ^ crcTable[0][high >> 24];
+
+		data += CRC_SLICES;
+		dataLength -= CRC_SLICES;
+	}
+
+	while (dataLength-- > 0) {
+
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#ifdef HUFF_X86
+/******************************************************************************
+	Name: updateCrcHardware
+
+	Des:
+		Add data to a running CRC32C with the SSE4.2 CRC32 instruction
+
+	Params:
+		crc - type unsigned int, the running CRC
+		data - type const unsigned char *, the data
+		dataLength - type size_t, the length of the data
+
+	Returns:
+		type unsigned int, the updated running CRC
+******************************************************************************/
+HUFF_TARGET_SSE42 unsigned int updateCrcHardware(unsigned int crc, const unsigned char *data, size_t dataLength) {
+
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned long long wideCrc = crc;
+
+	while (dataLength >= sizeof(long long)) {
+
+		unsigned long long word;
+
+		memcpy(&word, data, sizeof(long long));
+
+		wideCrc = _mm_crc32_u64(wideCrc, word);
+
+		data += sizeof(long long);
+		dataLength -= sizeof(long long);
+	}
+
+	crc = (unsigned int)wideCrc;
+#endif
+
+	while (dataLength-- > 0) {
+
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+
+	return crc;
+}
+#endif
+
+/******************************************************************************
+	Name: updateCrc
+
+	Des:
+		Add data to a running CRC32C. Start from CRC_INITIAL and invert the
+		result once all the data has been added
+
+	Params:
+		crc - type unsigned int, the running CRC
+		data - type const void *, the data
+		dataLength - type size_t, the length of the data
+
+	Returns:
+		type unsigned int, the updated running CRC
+******************************************************************************/
+unsigned int updateCrc(unsigned int crc, const void *data, size_t dataLength) {
+
+#ifdef HUFF_X86
+	if (hardwareCrc) {
+
+		return updateCrcHardware(crc, (const unsigned char *)data, dataLength);
+	}
+#endif
+
+	return updateCrcSoftware(crc, (const unsigned char *)data, dataLength);
+}
+
+/******************************************************************************
+	Name: runPoolTask
+
+	Des:
+		Run one task from the pool, taking the newest from the calling
+		thread's own queue or else stealing the oldest from another queue
+
+	Returns:
+		type bool, false if every queue was empty
+******************************************************************************/
+bool runPoolTask() {
+
+	const int queueCount = (int)taskPool.queues.size();
+	const int ownQueue = workerIndex >= 0 ? workerIndex : queueCount - 1;
+
+	for (int i = 0; i < queueCount; i++) {
+
+		TaskQueue &queue = taskPool.queues[(ownQueue + i) % queueCount];
+		function<void()> task;
+
+		{
+			lock_guard<mutex> guard(queue.lock);
+
+			if (queue.tasks.empty()) {
+
+				continue;
+			}
+
+			if (i == 0) {
+
+				task = move(queue.tasks.back());
+				queue.tasks.pop_back();
+			} else {
+
+				task = move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+		}
+
+		taskPool.queuedTasks--;
+		task();
+
+		return true;
+	}
+
+	return false;
+}
+
+/******************************************************************************
+	Name: submitPoolTask
+
+	Des:
+		Add a task to the calling thread's queue and wake a sleeping worker
+
+	Params:
+		task - type function<void()>, the task
+******************************************************************************/
+void submitPoolTask(function<void()> task) {
+
+	const int queueCount = (int)taskPool.queues.size();
+	TaskQueue &queue = taskPool.queues[workerIndex >= 0 ? workerIndex : queueCount - 1];
+
+	{
+		lock_guard<mutex> guard(queue.lock);
+
+		queue.tasks.push_back(move(task));
+	}
+
+	taskPool.queuedTasks++;
+
+	{
+		lock_guard<mutex> guard(taskPool.sleepLock);
+	}
+
+	taskPool.wakeUp.notify_one();
+}
+
+/******************************************************************************
+	Name: waitForPoolTasks
+
+	Des:
+		Run pool tasks until a count of outstanding tasks reaches zero. The
+		waiting thread does work rather than blocking, so a task may wait for
+		the tasks it submitted without tying up a worker
+
+	Params:
+		remainingTasks - type atomic<int> &, decremented by each task when it
+			finishes
+******************************************************************************/
+void waitForPoolTasks(atomic<int> &remainingTasks) {
+
+	while (remainingTasks > 0) {
+
+		if (!runPoolTask()) {
+
+			this_thread::yield();
+		}
+	}
+}
+
+/******************************************************************************
+	Name: startTaskPool
+
+	Des:
+		Start the pool's workers. The main thread works too whenever it waits,
+		so one core is left for it
+
+	Params:
+		threadCount - type int, the number of threads to keep busy
+******************************************************************************/
+void startTaskPool(int threadCount) {
+
+	int workerCount = max(0, threadCount - 1);
+
+	taskPool.queues = vector<TaskQueue>(workerCount + 1);
+
+	for (int i = 0; i < workerCount; i++) {
+
+		taskPool.workers.emplace_back([i]() {
+
+			workerIndex = i;
+
+			while (!taskPool.stopping) {
+
+				if (!runPoolTask()) {
+
+					unique_lock<mutex> sleep(taskPool.sleepLock);
+
+					taskPool.wakeUp.wait(sleep, []() { return taskPool.queuedTasks > 0 || taskPool.stopping; });
+				}
+			}
+		});
+	}
+}
+
+/******************************************************************************
+	Name: stopTaskPool
+
+	Des:
+		Stop the pool's workers once the work they were given is done
+******************************************************************************/
+void stopTaskPool() {
+
+	{
+		lock_guard<mutex> guard(taskPool.sleepLock);
+
+		taskPool.stopping = true;
+	}
+
+	taskPool.wakeUp.notify_all();
+
+	for (int i = 0; i < (int)taskPool.workers.size(); i++) {
+
+		taskPool.workers[i].join();
+	}
+
+	taskPool.workers.clear();
+}
+
+/******************************************************************************
+	Name: countGlyphs
+
+	Des:
+		Add the count of each byte in the data to a frequency table. Counts
+		are spread over several tables so that runs of the same byte do not
+		wait on each other's increments
+
+	Params:
+		data - type const unsigned char *, the data
+		dataLength - type int, the length of the data
+		frequencyTable - type int[], the table the counts are added to
+******************************************************************************/
+void countGlyphs(const unsigned char *data, int dataLength, int frequencyTable[MAX_GLYPHS]) {
+
+	int counts[HISTOGRAM_TABLES][BYTE_GLYPHS] = {};
+	int i = 0;
+
+	for (; i + HISTOGRAM_TABLES <= dataLength; i += HISTOGRAM_TABLES) {
+
+		for (int table = 0; table < HISTOGRAM_TABLES; table++) {
+
+			counts[table][data[i + table]]++;
+		}
+	}
+
+	for (; i < dataLength; i++) {
+
+		counts[0][data[i]]++;
+	}
+
+	for (int table = 0; table < HISTOGRAM_TABLES; table++) {
+
+		for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+			frequencyTable[glyph] += counts[table][glyph];
+		}
+	}
+}
+
+/******************************************************************************
+	Name: generateHuffmanTableFromFrequencies
+
+	Des:
+		Builds the leaves of the huffman table from a frequency table
+
+	Params:
+		frequencyTable - type int[MAX_GLYPHS], the frequency of each glyph
+
+	Returns:
+		type vector<HuffmanNode>, the huffman table
+******************************************************************************/
+vector<HuffmanNode> generateHuffmanTableFromFrequencies(int frequencyTable[MAX_GLYPHS]) {
+
+	vector<HuffmanNode> result;
+	result.reserve(MAX_HUFFMAN_NODES);
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		// If the glyph has a frequency greater than zero
+		if (frequencyTable[i] > 0) {
+
+			HuffmanNode node;
+
+			node.glyph = i;
+			node.frequency = frequencyTable[i];
+			node.left = DEFAULT_NODE_POINTER;
+			node.right = DEFAULT_NODE_POINTER;
+
+			result.push_back(node);
+		}
+	}
+
+	// Sort by frequency
+	sort(result.begin(), result.end(), [](HuffmanNode &a, HuffmanNode &b) {
+
+		return a.frequency < b.frequency;
+		});
+
+	return result;
+}
+
+/******************************************************************************
+	Name: generateInitialHuffmanTable
+
+	Des:
+		Builds the huffman table
+
+	Params:
+		data - type char *, the data for the huffman table
+		data - type int, the length of the data
+
+	Returns:
+		type vector<HuffmanNode>, the huffman table
+******************************************************************************/
+vector<HuffmanNode> generateInitialHuffmanTable(char *data, int dataLength) {
+
+	int frequencyTable[MAX_GLYPHS] = { 0 };
+
+	countGlyphs((unsigned char *)data, dataLength, frequencyTable);
+
+	frequencyTable[EOF_GLYPH] = 1;
+
+	return generateHuffmanTableFromFrequencies(frequencyTable);
+}
+
+/******************************************************************************
+	Name: reheap
+
+	Des:
+		Reheap the huffman table if necessary
+
+	Params:
+		huffmanTable - type vector<HuffmanNode> &, the huffman table
+		reheapStartIndex - type int, the index where the reheap should start
+		topOfHeap - type int, top of the heap of unsorted nodes
+******************************************************************************/
+void reheap(vector<HuffmanNode> &huffmanTable, int reheapStartIndex, int topOfHeap) {
+
+	const int leftNodeIndex = reheapStartIndex * 2 + 1;
+	const int rightNodeIndex = reheapStartIndex * 2 + 2;
+
+	if (rightNodeIndex <= topOfHeap) {
+
+		// Either left or right is less than start
+		if (huffmanTable[leftNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency || huffmanTable[rightNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency) {
+
+			// Right is less than left
+			if (huffmanTable[rightNodeIndex].frequency < huffmanTable[leftNodeIndex].frequency) {
+
+				HuffmanNode tempNode = huffmanTable[rightNodeIndex];
+
+				huffmanTable[rightNodeIndex] = huffmanTable[reheapStartIndex];
+				huffmanTable[reheapStartIndex] = tempNode;
+				reheap(huffmanTable, rightNodeIndex, topOfHeap);
+			// Left is less than or equal to right
+			} else {
+
+				HuffmanNode tempNode = huffmanTable[leftNodeIndex];
+
+				huffmanTable[leftNodeIndex] = huffmanTable[reheapStartIndex];
+				huffmanTable[reheapStartIndex] = tempNode;
+				reheap(huffmanTable, leftNodeIndex, topOfHeap);
+			}
+		}
+	} else if (leftNodeIndex == topOfHeap) {
+
+		if (huffmanTable[leftNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency) {
+
+			HuffmanNode tempNode = huffmanTable[leftNodeIndex];
+
+			huffmanTable[leftNodeIndex] = huffmanTable[reheapStartIndex];
+			huffmanTable[reheapStartIndex] = tempNode;
+			// Do not need to reheap final node
+		}
+	}
+}
+
+/******************************************************************************
+	Name: buildHuffmanTable
+
+	Des:
+		Builds the huffman table
+
+	Params:
+		huffmanTable - type vector<HuffmanNode> &, the huffman table
+		topOfHeap - type int, top of the heap of unsorted nodes
+******************************************************************************/
+void buildHuffmanTable(vector<HuffmanNode> &huffmanTable, int topOfHeap) {
+
+	int markedIndex;
+
+	if (topOfHeap != ROOT_NODE) {
+
+		// Mark the lower frequency glyph at the second or third index
+		if (topOfHeap == SLOT_TWO_INDEX) {
+
+			markedIndex = SLOT_TWO_INDEX;
+		} else {
+
+			if (huffmanTable[SLOT_TWO_INDEX].frequency > huffmanTable[SLOT_THREE_INDEX].frequency) {
+
+				markedIndex = SLOT_THREE_INDEX;
+			} else {
+
+				markedIndex = SLOT_TWO_INDEX;
+			}
+		}
+
+		huffmanTable.push_back(huffmanTable[markedIndex]);
+
+		if (topOfHeap != markedIndex) {
+
+			huffmanTable[markedIndex] = huffmanTable[topOfHeap];
+			reheap(huffmanTable, markedIndex, topOfHeap);
+		}
+
+		huffmanTable[topOfHeap] = huffmanTable[ROOT_NODE];
+
+		// Create merge node
+		HuffmanNode node;
+		node.glyph = DEFAULT_NODE_POINTER;
+		node.frequency = huffmanTable[topOfHeap].frequency + huffmanTable[huffmanTable.size() - 1].frequency;
+		node.left = topOfHeap;
+		node.right = (int)huffmanTable.size() - 1;
+
+		huffmanTable[ROOT_NODE] = node;
+
+		reheap(huffmanTable, ROOT_NODE, topOfHeap - 1);
+
+		buildHuffmanTable(huffmanTable, topOfHeap - 1);
+	}
+}
+
+/******************************************************************************
+	Name: generateBitcodes
+
+	Des:
+		Generate map of glyph bitcodes
+
+	Params:
+		huffmanTable - type vector<HuffmanNode> &, the huffman table
+		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
+		bitcode - type string, the current bitcode
+		currentIndex - type int, the current node index
+		oCompressedDataLength - type int &, the length of the compressedData
+******************************************************************************/
+void generateBitcodes(vector<HuffmanNode> &huffmanTable, string bitcodeArray[MAX_GLYPHS], string bitcode, int currentIndex, int &oCompressedDataLength) {
+
+	HuffmanNode currentNode = huffmanTable[currentIndex];
+
+	if (currentNode.left == DEFAULT_NODE_POINTER && currentNode.right == DEFAULT_NODE_POINTER) {
+
+		bitcodeArray[currentNode.glyph] = bitcode;
+		oCompressedDataLength += (int)bitcode.size() * currentNode.frequency;
+	} else {
+
+		if (currentNode.left != DEFAULT_NODE_POINTER) {
+
+			generateBitcodes(huffmanTable, bitcodeArray, bitcode + '0', currentNode.left, oCompressedDataLength);
+		}
+
+		if (currentNode.right != DEFAULT_NODE_POINTER) {
+
+			generateBitcodes(huffmanTable, bitcodeArray, bitcode + '1', currentNode.right, oCompressedDataLength);
+		}
+	}
+}
+
+/******************************************************************************
+	Name: packBitcodes
+
+	Des:
+		Pack each bitcode into a word with its first bit lowest, ready to be
+		shifted into the encoder's buffer
+
+	Params:
+		bitcodeArray - type string[], the bitcodes
+		oPackedCodes - type PackedCode[], the packed bitcodes
+
+	Returns:
+		type bool, false if a bitcode is too long to pack
+******************************************************************************/
+bool packBitcodes(string bitcodeArray[MAX_GLYPHS], PackedCode oPackedCodes[MAX_GLYPHS]) {
+
+	for (int glyph = 0; glyph < MAX_GLYPHS; glyph++) {
+
+		const string &bitcode = bitcodeArray[glyph];
+
+		if (bitcode.size() > MAX_PACKED_CODE_LENGTH) {
+
+			return false;
+		}
+
+		oPackedCodes[glyph].bits = 0;
+		oPackedCodes[glyph].length = (int)bitcode.size();
+
+		for (int j = 0; j < (int)bitcode.size(); j++) {
+
+			if (bitcode[j] == '1') {
+
+				oPackedCodes[glyph].bits |= 1ull << j;
+			}
+		}
+	}
+
+	return true;
+}
+
+/******************************************************************************
+	Name: buildPairCodes
+
+	Des:
+		Fill the pair table from the packed bitcodes of the byte glyphs
+
+	Params:
+		packedCodes - type const PackedCode[], the packed bitcodes
+		oPairCodes - type PairCode *, the PAIR_TABLE_SIZE entries to fill
+
+	Returns:
+		type bool, false if a byte's code is too long for the pair table
+******************************************************************************/
+bool buildPairCodes(const PackedCode packedCodes[MAX_GLYPHS], PairCode *oPairCodes) {
+
+	for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+		if (packedCodes[glyph].length > MAX_PAIR_CODE_LENGTH) {
+
+			return false;
+		}
+	}
+
+	for (int second = 0; second < BYTE_GLYPHS; second++) {
+
+		for (int first = 0; first < BYTE_GLYPHS; first++) {
+
+			PairCode &pair = oPairCodes[first | (second << BYTE_SIZE)];
+
+			pair.bits = (unsigned int)(packedCodes[first].bits | (packedCodes[second].bits << packedCodes[first].length));
+			pair.length = packedCodes[first].length + packedCodes[second].length;
+		}
+	}
+
+	return true;
+}
+
+/******************************************************************************
+	Name: encodePacked
+
+	Des:
+		Encode the data and the EOF glyph with packed bitcodes. Codes are
+		shifted into a 64 bit buffer and whole bytes are stored 8 at a time
+		while there is room, so each glyph costs two shifts and one store.
+		With a pair table two bytes are looked up and shifted in at once,
+		and the output is the same bit for bit
+
+	Params:
+		packedCodes - type const PackedCode[], the packed bitcodes
+		pairCodes - type const PairCode *, the pair table, or nullptr
+		data - type const unsigned char *, the data to encode
+		dataLength - type int, the length of the data
+		compressedData - type unsigned char *, the zeroed output
+		compressedDataLengthInBytes - type int, the length of the output
+
+	Returns:
+		type int, the number of bytes the codes took up
+******************************************************************************/
+template <typename BitOps>
+inline int encodePacked(const PackedCode packedCodes[MAX_GLYPHS], const PairCode *pairCodes, const unsigned char *data, int dataLength, unsigned char *compressedData, int compressedDataLengthInBytes) {
+
+	unsigned long long bitBuffer = 0;
+	int bitCount = 0;
+	int position = 0;
+	int i = 0;
+
+	// A pair is at most 32 bits on top of the 7 left over, so the buffer
+	// never overflows
+	if (pairCodes != nullptr) {
+
+		for (; i + 1 < dataLength && position + (int)sizeof(long long) <= compressedDataLengthInBytes; i += 2) {
+
+			const PairCode &pair = pairCodes[data[i] | (data[i + 1] << BYTE_SIZE)];
+
+			bitBuffer |= BitOps::shiftLeft(pair.bits, bitCount);
+			bitCount += pair.length;
+
+			memcpy(compressedData + position, &bitBuffer, sizeof(long long));
+
+			position += bitCount / BYTE_SIZE;
+			bitBuffer = BitOps::shiftRight(bitBuffer, bitCount & ~(BYTE_SIZE - 1));
+			bitCount &= BYTE_SIZE - 1;
+		}
+	}
+
+	for (; i <= dataLength; i++) {
+
+		const PackedCode &code = packedCodes[i < dataLength ? data[i] : EOF_GLYPH];
+
+		bitBuffer |= BitOps::shiftLeft(code.bits, bitCount);
+		bitCount += code.length;
+
+		if (position + (int)sizeof(long long) <= compressedDataLengthInBytes) {
+
+			memcpy(compressedData + position, &bitBuffer, sizeof(long long));
+
+			position += bitCount / BYTE_SIZE;
+			bitBuffer = BitOps::shiftRight(bitBuffer, bitCount & ~(BYTE_SIZE - 1));
+			bitCount &= BYTE_SIZE - 1;
+		} else {
+
+			for (; bitCount >= BYTE_SIZE && position < compressedDataLengthInBytes; bitCount -= BYTE_SIZE) {
+
+				compressedData[position++] = (unsigned char)bitBuffer;
+				bitBuffer >>= BYTE_SIZE;
+			}
+		}
+	}
+
+	if (bitCount > 0 && position < compressedDataLengthInBytes) {
+
+		compressedData[position++] = (unsigned char)bitBuffer;
+	}
+
+	return position;
+}
+
+#ifdef HUFF_X64
+/******************************************************************************
+	Name: encodePackedBmi2
+
+	Des:
+		encodePacked compiled with BMI2 shifts
+
+	Params:
+		packedCodes - type const PackedCode[], the packed bitcodes
+		pairCodes - type const PairCode *, the pair table, or nullptr
+		data - type const unsigned char *, the data to encode
+		dataLength - type int, the length of the data
+		compressedData - type unsigned char *, the zeroed output
+		compressedDataLengthInBytes - type int, the length of the output
+
+	Returns:
+		type int, the number of bytes the codes took up
+******************************************************************************/
+HUFF_TARGET_BMI2 int encodePackedBmi2(const PackedCode packedCodes[MAX_GLYPHS], const PairCode *pairCodes, const unsigned char *data, int dataLength, unsigned char *compressedData, int compressedDataLengthInBytes) {
+
+	return encodePacked<Bmi2BitOps>(packedCodes, pairCodes, data, dataLength, compressedData, compressedDataLengthInBytes);
+}
+#endif
+
+/******************************************************************************
+	Name: encodeWithKernel
+
+	Des:
+		Encode the data with packed bitcodes using the selected kernel, two
+		bytes at a time when the codes are short and the data long enough
+
+	Params:
+		packedCodes - type const PackedCode[], the packed bitcodes
+		data - type const unsigned char *, the data to encode
+		dataLength - type int, the length of the data
+		compressedData - type unsigned char *, the zeroed output
+		compressedDataLengthInBytes - type int, the length of the output
+
+	Returns:
+		type int, the number of bytes the codes took up
+******************************************************************************/
+int encodeWithKernel(const PackedCode packedCodes[MAX_GLYPHS], const unsigned char *data, int dataLength, unsigned char *compressedData, int compressedDataLengthInBytes) {
+
+	vector<PairCode> pairCodes;
+
+	if (dataLength >= PAIR_TABLE_MIN_LENGTH) {
+
+		pairCodes.resize(PAIR_TABLE_SIZE);
+
+		if (!buildPairCodes(packedCodes, pairCodes.data())) {
+
+			pairCodes.clear();
+		}
+	}
+
+	const PairCode *pairTable = pairCodes.empty() ? nullptr : pairCodes.data();
+
+#ifdef HUFF_X64
+	if (kernel >= KERNEL_BMI2) {
+
+		return encodePackedBmi2(packedCodes, pairTable, data, dataLength, compressedData, compressedDataLengthInBytes);
+	}
+#endif
+
+	return encodePacked<PortableBitOps>(packedCodes, pairTable, data, dataLength, compressedData, compressedDataLengthInBytes);
+}
+
+/******************************************************************************
+	Name: compressData
+
+	Des:
+		Compress the data using bitcodes. Codes that fit in a word are
+		packed and encoded with encodeWithKernel
+
+	Params:
+		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		compressedDataLengthInBytes - type int, the length of the
+			compressedData in bytes
+	Returns:
+		type unsigned char*, the compressed data
+******************************************************************************/
+unsigned char *compressData(string bitcodeArray[MAX_GLYPHS], char *data, int dataLength, int compressedDataLengthInBytes) {
+
+	unsigned char *compressedData = new unsigned char[compressedDataLengthInBytes] { 0 };
+
+	PackedCode packedCodes[MAX_GLYPHS];
+
+	if (packBitcodes(bitcodeArray, packedCodes)) {
+
+		encodeWithKernel(packedCodes, (unsigned char *)data, dataLength, compressedData, compressedDataLengthInBytes);
+		return compressedData;
+	}
+
+	int currentCompressedByte = 0;
+	int currentBit = 0;
+
+	// Codes too long to pack are written a character at a time
+	// Encode right to left
+	for (int i = 0; i < dataLength; i++) {
+
+		const string &bitcode = bitcodeArray[(unsigned char)data[i]];
+
+		const char *bitcodeChars = bitcode.c_str();
+		const size_t bitcodeSize = bitcode.size();
+
+		for (size_t j = 0; j < bitcodeSize; j++) {
+
+			if (currentBit >= (int)sizeof(char) * BYTE_SIZE) {
+
+				currentBit = 0;
+				currentCompressedByte++;
+			}
+
+			if (bitcodeChars[j] == '1') {
+
+				unsigned char bit = 0b00000001 << currentBit;
+				compressedData[currentCompressedByte] |= bit;
+			} else {
+
+				// Do nothing
+			}
+
+			currentBit++;
+		}
+	}
+
+	// Add EOF glyph
+	const string currentGlyphBitcode = bitcodeArray[EOF_GLYPH];
+
+	for (int j = 0; j < (int)currentGlyphBitcode.size(); j++) {
+
+		if (currentBit >= (int)sizeof(char) * BYTE_SIZE) {
+
+			currentBit = 0;
+			currentCompressedByte++;
+		}
+
+		if (currentGlyphBitcode[j] == '1') {
+
+			unsigned char bit = 0b00000001 << currentBit;
+			compressedData[currentCompressedByte] |= bit;
+		} else {
+
+			// Do nothing
+		}
+
+		currentBit++;
+	}
+
+	return compressedData;
+}
+
+/******************************************************************************
+	Name: generateCanonicalBitcodes
+
+	Des:
+		Generate canonical bitcodes from code lengths. Codes are assigned in
+		order of length and then glyph, so the lengths alone are enough for
+		Puff to rebuild the same codes
+
+	Params:
+		codeLengths - type unsigned char[MAX_GLYPHS], the code length of
+			each glyph, 0 if the glyph is unused
+		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
+******************************************************************************/
+void generateCanonicalBitcodes(const unsigned char codeLengths[MAX_GLYPHS], string bitcodeArray[MAX_GLYPHS]) {
+
+	unsigned long long code = 0;
+	int previousLength = 0;
+
+	for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+
+		for (int glyph = 0; glyph < MAX_GLYPHS; glyph++) {
+
+			if (codeLengths[glyph] == length) {
+
+				code <<= length - previousLength;
+				previousLength = length;
+
+				bitcodeArray[glyph].clear();
+
+				for (int bit = length - 1; bit >= 0; bit--) {
+
+					bitcodeArray[glyph] += ((code >> bit) & 1) ? '1' : '0';
+				}
+
+				code++;
+			}
+		}
+	}
+}
+
+/******************************************************************************
+	Name: getCompressedDataLength
+
+	Des:
+		Count the bytes needed to encode data with a set of bitcodes,
+		including the EOF glyph
+
+	Params:
+		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+
+	Returns:
+		type int, the length of the compressed data in bytes
+******************************************************************************/
+int getCompressedDataLength(string bitcodeArray[MAX_GLYPHS], char *data, int dataLength) {
+
+	long long compressedDataLength = bitcodeArray[EOF_GLYPH].size();
+
+	for (int i = 0; i < dataLength; i++) {
+
+		compressedDataLength += bitcodeArray[(unsigned char)data[i]].size();
+	}
+
+	return (int)((compressedDataLength + BYTE_SIZE - 1) / BYTE_SIZE);
+}
+
+/******************************************************************************
+	Name: limitCodeLengths
+
+	Des:
+		Limit code lengths to a maximum. Codes over the limit are cut to it,
+		then the least frequent shorter codes are lengthened until the code
+		is complete again, and any room left is used to shorten the most
+		frequent codes
+
+	Params:
+		frequencyTable - type int[MAX_GLYPHS], the frequency of each glyph
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths
+		maxCodeLength - type int, the longest code allowed
+******************************************************************************/
+void limitCodeLengths(int frequencyTable[MAX_GLYPHS], unsigned char codeLengths[MAX_GLYPHS], int maxCodeLength) {
+
+	const long long capacity = 1LL << maxCodeLength;
+
+	long long kraftSum = 0;
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		if (codeLengths[i] > maxCodeLength) {
+
+			codeLengths[i] = (unsigned char)maxCodeLength;
+		}
+
+		if (codeLengths[i] > 0) {
+
+			kraftSum += 1LL << (maxCodeLength - codeLengths[i]);
+		}
+	}
+
+	while (kraftSum > capacity) {
+
+		int lengthened = DEFAULT_NODE_POINTER;
+
+		for (int i = 0; i < MAX_GLYPHS; i++) {
+
+			if (codeLengths[i] > 0 && codeLengths[i] < maxCodeLength
+				&& (lengthened == DEFAULT_NODE_POINTER || frequencyTable[i] < frequencyTable[lengthened]
+					|| (frequencyTable[i] == frequencyTable[lengthened] && codeLengths[i] > codeLengths[lengthened]))) {
+
+				lengthened = i;
+			}
+		}
+
+		kraftSum -= 1LL << (maxCodeLength - codeLengths[lengthened] - 1);
+		codeLengths[lengthened]++;
+	}
+
+	int glyphs[MAX_GLYPHS];
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		glyphs[i] = i;
+	}
+
+	sort(glyphs, glyphs + MAX_GLYPHS, [&](int a, int b) {
+
+		return frequencyTable[a] > frequencyTable[b];
+		});
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		unsigned char &length = codeLengths[glyphs[i]];
+
+		while (length > 1 && kraftSum + (1LL << (maxCodeLength - length)) <= capacity) {
+
+			kraftSum += 1LL << (maxCodeLength - length);
+			length--;
+		}
+	}
+}
+
+/******************************************************************************
+	Name: generateCodeLengths
+
+	Des:
+		Build a huffman tree from a frequency table and return the code
+		length of each glyph, limited to a maximum length. A lone glyph is
+		given a one bit code
+
+	Params:
+		frequencyTable - type int[MAX_GLYPHS], the frequency of each glyph
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths, 0 for
+			glyphs that do not occur
+		maxCodeLength - type int, the longest code allowed
+******************************************************************************/
+void generateCodeLengths(int frequencyTable[MAX_GLYPHS], unsigned char codeLengths[MAX_GLYPHS], int maxCodeLength) {
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		codeLengths[i] = 0;
+	}
+
+	vector<HuffmanNode> huffmanTable = generateHuffmanTableFromFrequencies(frequencyTable);
+
+	if (huffmanTable.empty()) {
+
+		return;
+	}
+
+	if (huffmanTable.size() == 1) {
+
+		codeLengths[huffmanTable[ROOT_NODE].glyph] = 1;
+		return;
+	}
+
+	buildHuffmanTable(huffmanTable, (int)huffmanTable.size() - 1);
+
+	string bitcodeArray[MAX_GLYPHS];
+
+	int compressedDataLength = 0;
+
+	generateBitcodes(huffmanTable, bitcodeArray, "", ROOT_NODE, compressedDataLength);
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		codeLengths[i] = (unsigned char)min((int)bitcodeArray[i].size(), MAX_CODE_LENGTH);
+	}
+
+	limitCodeLengths(frequencyTable, codeLengths, maxCodeLength);
+}
+
+/******************************************************************************
+	Name: getStoredName
+
+	Des:
+		Work out the name stored in a huf image or archive directory for a
+		file. The path is normalized and its root and any leading ".."
+		components are removed, so Puff writes the file below the directory
+		it runs in and never over the original. "-" is kept for standard
+		input
+
+	Params:
+		fileName - type const string &, the name the file was given as
+
+	Returns:
+		type string, the name to store
+******************************************************************************/
+string getStoredName(const string &fileName) {
+
+	if (fileName == "-") {
+
+		return fileName;
+	}
+
+	filesystem::path storedPath;
+	filesystem::path relativePath = filesystem::path(fileName).lexically_normal().relative_path();
+
+	for (const filesystem::path &component : relativePath) {
+
+		if (!(storedPath.empty() && component == "..")) {
+
+			storedPath /= component;
+		}
+	}
+
+	// A name made only of a root and ".." still needs something to write to
+	if (storedPath.empty() || storedPath == ".") {
+
+		storedPath = "huff.out";
+	}
+
+	return storedPath.string();
+}
+
+/******************************************************************************
+	Name: writeHufImage
+
+	Des:
+		Write the header, huffman table and compressed data of a huf file,
+		with the name as getStoredName gives it
+
+	Params:
+		fout - type ostream &, the stream to write to
+		fileName - type string &, the name of the original file
+		huffmanTable - type vector<HuffmanNode> &, the huffman table
+		compressedData - type unsigned char *, the compressed data
+		compressedDataLengthInBytes - type int, the length of the
+			compressedData in bytes
+******************************************************************************/
+void writeHufImage(ostream &fout, string &fileName, vector<HuffmanNode> &huffmanTable, unsigned char *compressedData, int compressedDataLengthInBytes) {
+
+	string storedName = getStoredName(fileName);
+	size_t originalFileNameLength = storedName.size();
+	size_t numberOfHuffmanEntries = huffmanTable.size();
+
+	fout.write((char *)& originalFileNameLength, sizeof(int));
+	fout.write((char *)storedName.c_str(), originalFileNameLength);
+
+	fout.write((char *)& numberOfHuffmanEntries, sizeof(int));
+
+	for (int i = 0; i < (int)huffmanTable.size(); i++) {
+
+		fout.write((char *)& huffmanTable[i].glyph, sizeof(int));
+		fout.write((char *)& huffmanTable[i].left, sizeof(int));
+		fout.write((char *)& huffmanTable[i].right, sizeof(int));
+	}
+
+	fout.write((char *)compressedData, compressedDataLengthInBytes);
+}
+
+/******************************************************************************
+	Name: printHuffmanOutput
+
+	Des:
+		Build the huffman table for the data and write the compressed huf
+		image to a stream
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+******************************************************************************/
+void printHuffmanOutput(ostream &fout, string &fileName, char *data, int dataLength) {
+
+	vector<HuffmanNode> huffmanTable = generateInitialHuffmanTable(data, dataLength);
+
+	buildHuffmanTable(huffmanTable, (int)huffmanTable.size() - 1);
+
+	string bitcodeArray[MAX_GLYPHS];
+
+	int compressedDataLength = 0;
+
+	generateBitcodes(huffmanTable, bitcodeArray, "", ROOT_NODE, compressedDataLength);
+
+	// Convert from bits to bytes
+	compressedDataLength = (int)ceil(compressedDataLength / (double)BYTE_SIZE);
+
+	unsigned char *compressedData = compressData(bitcodeArray, data, dataLength, compressedDataLength);
+
+	writeHufImage(fout, fileName, huffmanTable, compressedData, compressedDataLength);
+
+	delete[] compressedData;
+}
+
+/******************************************************************************
+	Name: writeBlockFileHeader
+
+	Des:
+		Write the magic number and original file name that start a block
+		format huf file, with the name as getStoredName gives it
+
+	Params:
+		fout - type ostream &, the stream to write to
+		fileName - type string &, the name of the original file
+******************************************************************************/
+void writeBlockFileHeader(ostream &fout, string &fileName) {
+
+	string storedName = getStoredName(fileName);
+	int originalFileNameLength = (int)storedName.size();
+
+	fout.write((char *)& BLOCK_FILE_MAGIC, sizeof(int));
+	fout.write((char *)& originalFileNameLength, sizeof(int));
+	fout.write((char *)storedName.c_str(), originalFileNameLength);
+}
+
+/******************************************************************************
+	Name: writeBlockHeader
+
+	Des:
+		Write the header that precedes every block of a block format huf file
+
+	Params:
+		fout - type ostream &, the stream to write to
+		blockType - type int, what the payload holds
+		rawLength - type int, the length of the data the block decodes to
+		payloadLength - type int, the length of the payload that follows
+		checksum - type unsigned int, the CRC32C of the data the block
+			decodes to
+******************************************************************************/
+void writeBlockHeader(ostream &fout, int blockType, int rawLength, int payloadLength, unsigned int checksum) {
+
+	fout.write((char *)& blockType, sizeof(int));
+	fout.write((char *)& rawLength, sizeof(int));
+	fout.write((char *)& payloadLength, sizeof(int));
+	fout.write((char *)& checksum, sizeof(int));
+}
+
+/******************************************************************************
+	Name: writeBlockFileFooter
+
+	Des:
+		Write the end block and the checksum of the whole file
+
+	Params:
+		fout - type ostream &, the stream to write to
+		fileChecksum - type unsigned int, the CRC32C of all the original data
+******************************************************************************/
+void writeBlockFileFooter(ostream &fout, unsigned int fileChecksum) {
+
+	fout.write((char *)& BLOCK_END, sizeof(int));
+	fout.write((char *)& fileChecksum, sizeof(int));
+}
+
+/******************************************************************************
+	Name: printSingleBlockOutput
+
+	Des:
+		Write a block format huf file holding one block. The block checksum
+		and the file checksum are the same
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		blockType - type int, what the payload holds
+		payload - type vector<unsigned char> &, the block payload
+******************************************************************************/
+void printSingleBlockOutput(ostream &fout, string &fileName, char *data, int dataLength, int blockType, vector<unsigned char> &payload) {
+
+	unsigned int checksum = ~updateCrc(CRC_INITIAL, data, dataLength);
+
+	writeBlockFileHeader(fout, fileName);
+
+	writeBlockHeader(fout, blockType, dataLength, (int)payload.size(), checksum);
+	fout.write((char *)payload.data(), payload.size());
+
+	writeBlockFileFooter(fout, checksum);
+}
+
+/******************************************************************************
+	Name: compressDictionaryBlock
+
+	Des:
+		Code one block with a shared dictionary table. The payload holds the
+		dictionary ID and the bits
+
+	Params:
+		data - type char *, the block
+		dataLength - type int, the length of the block
+		dictionary - type Dictionary &, the shared table
+
+	Returns:
+		type vector<unsigned char>, the block payload
+******************************************************************************/
+vector<unsigned char> compressDictionaryBlock(char *data, int dataLength, Dictionary &dictionary) {
+
+	int compressedDataLength = getCompressedDataLength(dictionary.bitcodeArray, data, dataLength);
+
+	unsigned char *compressedData = compressData(dictionary.bitcodeArray, data, dataLength, compressedDataLength);
+
+	vector<unsigned char> payload(sizeof(int));
+
+	memcpy(payload.data(), &dictionary.id, sizeof(int));
+	payload.insert(payload.end(), compressedData, compressedData + compressedDataLength);
+
+	delete[] compressedData;
+
+	return payload;
+}
+
+/******************************************************************************
+	Name: printDictionaryOutput
+
+	Des:
+		Write the data as a block format huf file coded with a shared
+		dictionary table, so no table is stored in the file
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		dictionary - type Dictionary &, the shared table
+******************************************************************************/
+void printDictionaryOutput(ostream &fout, string &fileName, char *data, int dataLength, Dictionary &dictionary) {
+
+	vector<unsigned char> payload = compressDictionaryBlock(data, dataLength, dictionary);
+
+	printSingleBlockOutput(fout, fileName, data, dataLength, BLOCK_DICTIONARY, payload);
+}
+
+/******************************************************************************
+	Name: writeBit
+
+	Des:
+		Append a bit to a bit writer, filling each byte right to left like
+		compressData
+
+	Params:
+		writer - type BitWriter &, the bit writer
+		bit - type int, the bit to append
+******************************************************************************/
+void writeBit(BitWriter &writer, int bit) {
+
+	if (writer.currentBit >= BYTE_SIZE) {
+
+		writer.bytes.push_back(0);
+		writer.currentBit = 0;
+	}
+
+	if (bit) {
+
+		writer.bytes.back() |= (unsigned char)(0b00000001 << writer.currentBit);
+	}
+
+	writer.currentBit++;
+}
+
+/******************************************************************************
+	Name: writeBitcode
+
+	Des:
+		Append a bitcode to a bit writer
+
+	Params:
+		writer - type BitWriter &, the bit writer
+		bitcode - type const string &, the bitcode to append
+******************************************************************************/
+void writeBitcode(BitWriter &writer, const string &bitcode) {
+
+	for (int i = 0; i < (int)bitcode.size(); i++) {
+
+		writeBit(writer, bitcode[i] == '1');
+	}
+}
+
+/******************************************************************************
+	Name: getCompactCodeLengthsSize
+
+	Des:
+		Get the size of a table stored by writeCompactCodeLengths
+
+	Params:
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths
+		glyphCount - type int, the number of glyphs in the alphabet
+
+	Returns:
+		type int, the size in bytes
+******************************************************************************/
+int getCompactCodeLengthsSize(const unsigned char codeLengths[MAX_GLYPHS], int glyphCount) {
+
+	int usedGlyphs = 0;
+
+	for (int i = 0; i < glyphCount; i++) {
+
+		usedGlyphs += codeLengths[i] > 0;
+	}
+
+	return (glyphCount + BYTE_SIZE - 1) / BYTE_SIZE + (usedGlyphs + 1) / 2;
+}
+
+/******************************************************************************
+	Name: writeCompactCodeLengths
+
+	Des:
+		Store the code lengths of the first glyphCount glyphs as a bitmap of
+		the glyphs used followed by a 4 bit length for each of them
+
+	Params:
+		payload - type vector<unsigned char> &, the buffer to append to
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths
+		glyphCount - type int, the number of glyphs in the alphabet
+******************************************************************************/
+void writeCompactCodeLengths(vector<unsigned char> &payload, const unsigned char codeLengths[MAX_GLYPHS], int glyphCount) {
+
+	size_t bitmapStart = payload.size();
+
+	payload.resize(bitmapStart + (glyphCount + BYTE_SIZE - 1) / BYTE_SIZE, 0);
+
+	bool highNibble = false;
+
+	for (int i = 0; i < glyphCount; i++) {
+
+		if (codeLengths[i] > 0) {
+
+			payload[bitmapStart + i / BYTE_SIZE] |= (unsigned char)(1 << (i % BYTE_SIZE));
+
+			if (highNibble) {
+
+				payload.back() |= (unsigned char)(codeLengths[i] << 4);
+			} else {
+
+				payload.push_back(codeLengths[i]);
+			}
+
+			highNibble = !highNibble;
+		}
+	}
+}
+
+/******************************************************************************
+	Name: getCodeLengthChangesSize
+
+	Des:
+		Get the size of the changes writeCodeLengthChanges would store
+
+	Params:
+		previousLengths - type const unsigned char *, the code lengths before
+		codeLengths - type const unsigned char *, the code lengths after
+
+	Returns:
+		type int, the size in bytes
+******************************************************************************/
+int getCodeLengthChangesSize(const unsigned char *previousLengths, const unsigned char *codeLengths) {
+
+	int changedGlyphs = 0;
+
+	for (int i = 0; i < BYTE_GLYPHS; i++) {
+
+		changedGlyphs += codeLengths[i] != previousLengths[i];
+	}
+
+	return BYTE_GLYPHS / BYTE_SIZE + (changedGlyphs + 1) / 2;
+}
+
+/******************************************************************************
+	Name: writeCodeLengthChanges
+
+	Des:
+		Store the byte values whose code lengths changed as a bitmap followed
+		by the 4 bit new length of each, which may be 0
+
+	Params:
+		payload - type vector<unsigned char> &, the buffer to append to
+		previousLengths - type const unsigned char *, the code lengths before
+		codeLengths - type const unsigned char *, the code lengths after
+******************************************************************************/
+void writeCodeLengthChanges(vector<unsigned char> &payload, const unsigned char *previousLengths, const unsigned char *codeLengths) {
+
+	size_t bitmapStart = payload.size();
+
+	payload.resize(bitmapStart + BYTE_GLYPHS / BYTE_SIZE, 0);
+
+	bool highNibble = false;
+
+	for (int i = 0; i < BYTE_GLYPHS; i++) {
+
+		if (codeLengths[i] != previousLengths[i]) {
+
+			payload[bitmapStart + i / BYTE_SIZE] |= (unsigned char)(1 << (i % BYTE_SIZE));
+
+			if (highNibble) {
+
+				payload.back() |= (unsigned char)(codeLengths[i] << 4);
+			} else {
+
+				payload.push_back(codeLengths[i]);
+			}
+
+			highNibble = !highNibble;
+		}
+	}
+}
+
+/******************************************************************************
+	Name: getCodedBitLength
+
+	Des:
+		Count the bits needed to code a histogram with a set of code lengths
+
+	Params:
+		frequencyTable - type int[MAX_GLYPHS], the frequency of each glyph
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths
+
+	Returns:
+		type long long, the number of bits
+******************************************************************************/
+long long getCodedBitLength(const int frequencyTable[MAX_GLYPHS], const unsigned char codeLengths[MAX_GLYPHS]) {
+
+	long long bitLength = 0;
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		bitLength += (long long)frequencyTable[i] * codeLengths[i];
+	}
+
+	return bitLength;
+}
+
+/******************************************************************************
+	Name: compressOrder1Block
+
+	Des:
+		Code one block with an order-1 context model. Each previous byte
+		selects a table. A context only gets its own table when that saves
+		more bits than the table costs, the rest share one fallback table
+		built from their combined counts
+
+	Params:
+		data - type char *, the block
+		dataLength - type int, the length of the block
+
+	Returns:
+		type vector<unsigned char>, the block payload
+******************************************************************************/
+vector<unsigned char> compressOrder1Block(char *data, int dataLength) {
+
+	vector<int> contextFrequencies(ORDER1_CONTEXTS * MAX_GLYPHS, 0);
+
+	unsigned char context = 0;
+
+	for (int i = 0; i < dataLength; i++) {
+
+		unsigned char glyph = data[i];
+
+		contextFrequencies[context * MAX_GLYPHS + glyph]++;
+		context = glyph;
+	}
+
+	int fallbackFrequencies[MAX_GLYPHS] = { 0 };
+
+	for (int c = 0; c < ORDER1_CONTEXTS; c++) {
+
+		for (int i = 0; i < MAX_GLYPHS; i++) {
+
+			fallbackFrequencies[i] += contextFrequencies[c * MAX_GLYPHS + i];
+		}
+	}
+
+	unsigned char fallbackLengths[MAX_GLYPHS];
+
+	generateCodeLengths(fallbackFrequencies, fallbackLengths, ORDER1_MAX_CODE_LENGTH);
+
+	// Give a context its own table when that is cheaper than the fallback
+	vector<unsigned char> contextLengths(ORDER1_CONTEXTS * MAX_GLYPHS, 0);
+	bool ownTable[ORDER1_CONTEXTS] = { false };
+
+	for (int c = 0; c < ORDER1_CONTEXTS; c++) {
+
+		int *frequencyTable = &contextFrequencies[c * MAX_GLYPHS];
+		unsigned char *codeLengths = &contextLengths[c * MAX_GLYPHS];
+
+		generateCodeLengths(frequencyTable, codeLengths, ORDER1_MAX_CODE_LENGTH);
+
+		long long ownCost = getCodedBitLength(frequencyTable, codeLengths) + (long long)getCompactCodeLengthsSize(codeLengths, BYTE_GLYPHS) * BYTE_SIZE;
+
+		if (ownCost < getCodedBitLength(frequencyTable, fallbackLengths)) {
+
+			ownTable[c] = true;
+
+			for (int i = 0; i < MAX_GLYPHS; i++) {
+
+				fallbackFrequencies[i] -= frequencyTable[i];
+			}
+		}
+	}
+
+	// Rebuild the fallback from the contexts left sharing it
+	generateCodeLengths(fallbackFrequencies, fallbackLengths, ORDER1_MAX_CODE_LENGTH);
+
+	bool fallbackUsed = false;
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		fallbackUsed = fallbackUsed || fallbackFrequencies[i] > 0;
+	}
+
+	vector<unsigned char *> tables;
+	unsigned char contextTable[ORDER1_CONTEXTS] = { 0 };
+
+	if (fallbackUsed) {
+
+		tables.push_back(fallbackLengths);
+	}
+
+	for (int c = 0; c < ORDER1_CONTEXTS; c++) {
+
+		if (ownTable[c]) {
+
+			contextTable[c] = (unsigned char)tables.size();
+			tables.push_back(&contextLengths[c * MAX_GLYPHS]);
+		}
+	}
+
+	vector<string> bitcodeArrays(tables.size() * MAX_GLYPHS);
+	vector<unsigned char> payload;
+
+	int tableCount = (int)tables.size();
+
+	payload.resize(sizeof(int));
+	memcpy(payload.data(), &tableCount, sizeof(int));
+
+	// With a single table every context uses it, so the map is left out
+	if (tableCount > 1) {
+
+		payload.insert(payload.end(), contextTable, contextTable + ORDER1_CONTEXTS);
+	}
+
+	for (int t = 0; t < (int)tables.size(); t++) {
+
+		writeCompactCodeLengths(payload, tables[t], BYTE_GLYPHS);
+		generateCanonicalBitcodes(tables[t], &bitcodeArrays[t * MAX_GLYPHS]);
+	}
+
+	BitWriter writer;
+
+	context = 0;
+
+	for (int i = 0; i < dataLength; i++) {
+
+		unsigned char glyph = data[i];
+
+		writeBitcode(writer, bitcodeArrays[contextTable[context] * MAX_GLYPHS + glyph]);
+		context = glyph;
+	}
+
+	payload.insert(payload.end(), writer.bytes.begin(), writer.bytes.end());
+
+	return payload;
+}
+
+/******************************************************************************
+	Name: printOrder1Output
+
+	Des:
+		Write the data as a block format huf file of one order-1 block
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+******************************************************************************/
+void printOrder1Output(ostream &fout, string &fileName, char *data, int dataLength) {
+
+	vector<unsigned char> payload = compressOrder1Block(data, dataLength);
+
+	printSingleBlockOutput(fout, fileName, data, dataLength, BLOCK_ORDER1, payload);
+}
+
+/******************************************************************************
+	Name: writeBits
+
+	Des:
+		Append the low bits of a value to a bit writer, lowest bit first
+
+	Params:
+		writer - type BitWriter &, the bit writer
+		value - type int, the value
+		bitCount - type int, the number of bits to append
+******************************************************************************/
+void writeBits(BitWriter &writer, int value, int bitCount) {
+
+	for (int i = 0; i < bitCount; i++) {
+
+		writeBit(writer, (value >> i) & 1);
+	}
+}
+
+/******************************************************************************
+	Name: getLzCode
+
+	Des:
+		Split a match length or distance into a code and extra bits. Values
+		below 4 are their own code, above that each power of two is split
+		into two codes whose extra bits hold the rest of the value
+
+	Params:
+		value - type int, the length minus LZ_MIN_MATCH or distance minus 1
+		oExtraBitCount - type int &, the number of extra bits
+		oExtraValue - type int &, the value of the extra bits
+
+	Returns:
+		type int, the code
+******************************************************************************/
+int getLzCode(int value, int &oExtraBitCount, int &oExtraValue) {
+
+	if (value < 4) {
+
+		oExtraBitCount = 0;
+		oExtraValue = 0;
+
+		return value;
+	}
+
+	int highestBit = 0;
+
+	while ((value >> (highestBit + 1)) != 0) {
+
+		highestBit++;
+	}
+
+	oExtraBitCount = highestBit - 1;
+	oExtraValue = value & ((1 << oExtraBitCount) - 1);
+
+	return 2 * highestBit + ((value >> oExtraBitCount) & 1);
+}
+
+/******************************************************************************
+	Name: getMatchLength
+
+	Des:
+		Count how many bytes two strings share at their start, comparing a
+		word at a time and finding the differing byte within the word
+
+	Params:
+		first - type const unsigned char *, the earlier string
+		second - type const unsigned char *, the later string
+		maxLength - type int, the most bytes to compare
+
+	Returns:
+		type int, the length of the match
+******************************************************************************/
+inline int getMatchLength(const unsigned char *first, const unsigned char *second, int maxLength) {
+
+	int length = 0;
+
+	while (length + (int)sizeof(unsigned long long) <= maxLength) {
+
+		unsigned long long firstWord;
+		unsigned long long secondWord;
+
+		memcpy(&firstWord, first + length, sizeof(firstWord));
+		memcpy(&secondWord, second + length, sizeof(secondWord));
+
+		if (firstWord != secondWord) {
+
+			break;
+		}
+
+		length += sizeof(unsigned long long);
+	}
+
+	while (length < maxLength && first[length] == second[length]) {
+
+		length++;
+	}
+
+	return length;
+}
+
+/******************************************************************************
+	Name: parseLzTokens
+
+	Des:
+		Split data into literals and matches with a hash chain match finder.
+		Every position is hashed on its first three bytes, and the chain of
+		earlier positions with the same hash is searched for the longest
+		match inside the window. The first historyLength bytes are only
+		hashed, so later matches can reach back into them but no tokens are
+		made for them
+
+	Params:
+		data - type char *, the history followed by the data to parse
+		dataLength - type int, the length of the history and data
+		historyLength - type int, the length of the history
+		windowBits - type int, log2 of the largest match distance
+		effort - type int, 1 to LZ_MAX_EFFORT, how hard to search
+
+	Returns:
+		type vector<LzToken>, the literals and matches in order
+******************************************************************************/
+vector<LzToken> parseLzTokens(char *data, int dataLength, int historyLength, int windowBits, int effort) {
+
+	const unsigned char *bytes = (const unsigned char *)data;
+	const int windowSize = 1 << windowBits;
+	const int windowMask = windowSize - 1;
+	const LzSearchLimits &limits = LZ_SEARCH_LIMITS[effort];
+
+	// A wider window gets more hash buckets, so chains hold fewer positions
+	// whose first three bytes only share a hash
+	const int hashBits = min(max(windowBits, LZ_MIN_HASH_BITS), LZ_MAX_HASH_BITS);
+
+	vector<int> head(1 << hashBits, DEFAULT_NODE_POINTER);
+	vector<int> previous(windowSize, DEFAULT_NODE_POINTER);
+	vector<LzToken> tokens;
+
+	tokens.reserve((dataLength - historyLength) / 2);
+
+	auto hashAt = [&](int position) {
+
+		unsigned int key = (bytes[position] << 16) | (bytes[position + 1] << 8) | bytes[position + 2];
+
+		return (int)((key * 2654435761u) >> (32 - hashBits));
+	};
+
+	auto insert = [&](int position) {
+
+		if (position + LZ_MIN_MATCH <= dataLength) {
+
+			int hash = hashAt(position);
+
+			previous[position & windowMask] = head[hash];
+			head[hash] = position;
+		}
+	};
+
+	// oChainWork counts the links walked, so the lazy search can be given
+	// what is left of the position's chain
+	auto findMatch = [&](int position, int chainLength, int &oDistance, int &oChainWork) {
+
+		int bestLength = 0;
+
+		if (position + LZ_MIN_MATCH > dataLength) {
+
+			return bestLength;
+		}
+
+		const int maxLength = min(LZ_MAX_MATCH, dataLength - position);
+		const int niceLength = min(limits.niceLength, maxLength);
+		int candidate = head[hashAt(position)];
+
+		for (int chain = 0; chain < chainLength && candidate != DEFAULT_NODE_POINTER && position - candidate <= windowSize; chain++) {
+
+			oChainWork++;
+
+			// Only a candidate that could beat the best match is compared
+			if (bytes[candidate + bestLength] == bytes[position + bestLength] && bytes[candidate] == bytes[position]) {
+
+				int length = getMatchLength(bytes + candidate, bytes + position, maxLength);
+
+				if (length > bestLength) {
+
+					bestLength = length;
+					oDistance = position - candidate;
+
+					if (length >= niceLength) {
+
+						break;
+					}
+
+					// A good match is not worth the rest of a long chain
+					if (length >= limits.goodLength) {
+
+						chainLength = min(chainLength, chain + 1 + limits.chainLength / 4);
+					}
+				}
+			}
+
+			int next = previous[candidate & windowMask];
+
+			// Slots are reused once a position leaves the window
+			if (next >= candidate) {
+
+				break;
+			}
+
+			candidate = next;
+		}
+
+		return bestLength;
+	};
+
+	for (int i = max(0, historyLength - windowSize); i < historyLength; i++) {
+
+		insert(i);
+	}
+
+	int position = historyLength;
+
+	while (position < dataLength) {
+
+		int distance = 0;
+		int chainWork = 0;
+		int length = findMatch(position, limits.chainLength, distance, chainWork);
+
+		insert(position);
+
+		int lazyChainLength = min(length >= limits.goodLength ? limits.chainLength / 4 : limits.chainLength, limits.chainLength - chainWork);
+
+		if (length >= LZ_MIN_MATCH && length < limits.lazyLength && lazyChainLength > 0 && position + 1 < dataLength) {
+
+			int nextDistance = 0;
+			int nextLength = findMatch(position + 1, lazyChainLength, nextDistance, chainWork);
+
+			// A longer match one byte later is worth a literal
+			if (nextLength > length) {
+
+				tokens.push_back({ 0, 0, bytes[position] });
+				position++;
+
+				length = nextLength;
+				distance = nextDistance;
+
+				insert(position);
+			}
+		}
+
+		if (length >= LZ_MIN_MATCH) {
+
+			tokens.push_back({ length, distance, 0 });
+
+			for (int i = 1; i < length; i++) {
+
+				insert(position + i);
+			}
+
+			position += length;
+		} else {
+
+			tokens.push_back({ 0, 0, bytes[position] });
+			position++;
+		}
+	}
+
+	return tokens;
+}
+
+/******************************************************************************
+	Name: appendLzPayload
+
+	Des:
+		Code data with the LZ stage in front of the huffman coding. Literals
+		and match flags, match length codes and distance codes each get a
+		huffman table, and the extra bits of the codes are written raw after
+		them
+
+	Params:
+		payload - type vector<unsigned char> &, the payload to add to
+		data - type char *, the history followed by the data to code
+		dataLength - type int, the length of the history and data
+		historyLength - type int, the length of the history, which matches
+			may reach back into but is not coded
+		windowBits - type int, log2 of the largest match distance
+		effort - type int, 1 to LZ_MAX_EFFORT, how hard to search
+******************************************************************************/
+void appendLzPayload(vector<unsigned char> &payload, char *data, int dataLength, int historyLength, int windowBits, int effort) {
+
+	vector<LzToken> tokens = parseLzTokens(data, dataLength, historyLength, windowBits, effort);
+
+	int literalFrequencies[MAX_GLYPHS] = { 0 };
+	int lengthFrequencies[MAX_GLYPHS] = { 0 };
+	int distanceFrequencies[MAX_GLYPHS] = { 0 };
+
+	int extraBitCount;
+	int extraValue;
+
+	for (int i = 0; i < (int)tokens.size(); i++) {
+
+		if (tokens[i].length == 0) {
+
+			literalFrequencies[tokens[i].literal]++;
+		} else {
+
+			literalFrequencies[LZ_MATCH_GLYPH]++;
+			lengthFrequencies[getLzCode(tokens[i].length - LZ_MIN_MATCH, extraBitCount, extraValue)]++;
+			distanceFrequencies[getLzCode(tokens[i].distance - 1, extraBitCount, extraValue)]++;
+		}
+	}
+
+	unsigned char literalLengths[MAX_GLYPHS];
+	unsigned char lengthLengths[MAX_GLYPHS];
+	unsigned char distanceLengths[MAX_GLYPHS];
+
+	generateCodeLengths(literalFrequencies, literalLengths, MAX_BLOCK_CODE_LENGTH);
+	generateCodeLengths(lengthFrequencies, lengthLengths, MAX_BLOCK_CODE_LENGTH);
+	generateCodeLengths(distanceFrequencies, distanceLengths, MAX_BLOCK_CODE_LENGTH);
+
+	string literalBitcodes[MAX_GLYPHS];
+	string lengthBitcodes[MAX_GLYPHS];
+	string distanceBitcodes[MAX_GLYPHS];
+
+	generateCanonicalBitcodes(literalLengths, literalBitcodes);
+	generateCanonicalBitcodes(lengthLengths, lengthBitcodes);
+	generateCanonicalBitcodes(distanceLengths, distanceBitcodes);
+
+	writeCompactCodeLengths(payload, literalLengths, MAX_GLYPHS);
+	writeCompactCodeLengths(payload, lengthLengths, LZ_LENGTH_CODES);
+	writeCompactCodeLengths(payload, distanceLengths, LZ_DISTANCE_CODES);
+
+	BitWriter writer;
+
+	for (int i = 0; i < (int)tokens.size(); i++) {
+
+		if (tokens[i].length == 0) {
+
+			writeBitcode(writer, literalBitcodes[tokens[i].literal]);
+		} else {
+
+			writeBitcode(writer, literalBitcodes[LZ_MATCH_GLYPH]);
+
+			int lengthCode = getLzCode(tokens[i].length - LZ_MIN_MATCH, extraBitCount, extraValue);
+
+			writeBitcode(writer, lengthBitcodes[lengthCode]);
+			writeBits(writer, extraValue, extraBitCount);
+
+			int distanceCode = getLzCode(tokens[i].distance - 1, extraBitCount, extraValue);
+
+			writeBitcode(writer, distanceBitcodes[distanceCode]);
+			writeBits(writer, extraValue, extraBitCount);
+		}
+	}
+
+	payload.insert(payload.end(), writer.bytes.begin(), writer.bytes.end());
+}
+
+/******************************************************************************
+	Name: compressLzBlock
+
+	Des:
+		Code one block with the LZ stage, with no history before it
+
+	Params:
+		data - type char *, the block
+		dataLength - type int, the length of the block
+		options - type const CompressionOptions &, the window and effort to
+			use
+
+	Returns:
+		type vector<unsigned char>, the block payload
+******************************************************************************/
+vector<unsigned char> compressLzBlock(char *data, int dataLength, const CompressionOptions &options) {
+
+	int windowBits = max(LZ_MIN_WINDOW_BITS, min(options.lzWindowBits, LZ_MAX_WINDOW_BITS));
+	int effort = max(1, min(options.lzEffort, LZ_MAX_EFFORT));
+
+	vector<unsigned char> payload;
+
+	appendLzPayload(payload, data, dataLength, 0, windowBits, effort);
+
+	return payload;
+}
+
+/******************************************************************************
+	Name: printLzOutput
+
+	Des:
+		Write the data as a block format huf file of one LZ block
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		options - type CompressionOptions &, the window and effort to use
+******************************************************************************/
+void printLzOutput(ostream &fout, string &fileName, char *data, int dataLength, CompressionOptions &options) {
+
+	vector<unsigned char> payload = compressLzBlock(data, dataLength, options);
+
+	printSingleBlockOutput(fout, fileName, data, dataLength, BLOCK_LZ, payload);
+}
+
+/******************************************************************************
+	Name: printDeltaOutput
+
+	Des:
+		Write the data as a block format huf file of one delta block, coded
+		by the LZ stage with the reference file loaded into the window first.
+		Whatever the data shares with the reference becomes matches, so a
+		revision costs little more than its changes. The window is widened
+		to hold the reference and the data, up to the largest LZ window.
+		Past that, later data can not reach the start of the reference,
+		which is reported since the delta will be larger than expected
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		options - type CompressionOptions &, the reference, window and
+			effort to use
+******************************************************************************/
+void printDeltaOutput(ostream &fout, string &fileName, char *data, int dataLength, CompressionOptions &options) {
+
+	const ReferenceFile &reference = *options.reference;
+	const int referenceLength = (int)reference.data.size();
+
+	int windowBits = max(LZ_MIN_WINDOW_BITS, min(options.lzWindowBits, LZ_MAX_WINDOW_BITS));
+	int effort = max(1, min(options.lzEffort, LZ_MAX_EFFORT));
+
+	while (windowBits < LZ_MAX_WINDOW_BITS && (1LL << windowBits) < (long long)referenceLength + dataLength) {
+
+		windowBits++;
+	}
+
+	if ((1LL << windowBits) < (long long)referenceLength + dataLength) {
+
+		cout << "Matches in " + fileName + " reach back at most " + to_string(1 << windowBits) + " bytes, so the start of the reference can not be used\n";
+	}
+
+	vector<char> window(reference.data);
+
+	window.insert(window.end(), data, data + dataLength);
+
+	vector<unsigned char> payload(sizeof(unsigned int) + sizeof(int));
+
+	memcpy(payload.data(), &reference.checksum, sizeof(unsigned int));
+	memcpy(payload.data() + sizeof(unsigned int), &referenceLength, sizeof(int));
+
+	appendLzPayload(payload, window.data(), (int)window.size(), referenceLength, windowBits, effort);
+
+	printSingleBlockOutput(fout, fileName, data, dataLength, BLOCK_DELTA, payload);
+}
+
+/******************************************************************************
+	Name: buildSuffixArray
+
+	Des:
+		Build the suffix array of a string in linear time with SA-IS. The
+		last character must be a unique 0 sentinel. LMS substrings are sorted
+		by induced sorting, named, and sorted recursively when names repeat,
+		then the order of the LMS suffixes induces the full array
+
+	Params:
+		text - type const int *, the string, values below alphabetSize
+		suffixArray - type int *, the array of length suffixes to fill
+		length - type int, the length of the string
+		alphabetSize - type int, one more than the largest character
+******************************************************************************/
+void buildSuffixArray(const int *text, int *suffixArray, int length, int alphabetSize) {
+
+	vector<bool> sType(length);
+	vector<int> buckets(alphabetSize);
+
+	sType[length - 1] = true;
+
+	for (int i = length - 2; i >= 0; i--) {
+
+		sType[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && sType[i + 1]);
+	}
+
+	auto isLms = [&](int i) {
+
+		return i > 0 && sType[i] && !sType[i - 1];
+	};
+
+	auto getBuckets = [&](bool bucketEnds) {
+
+		fill(buckets.begin(), buckets.end(), 0);
+
+		for (int i = 0; i < length; i++) {
+
+			buckets[text[i]]++;
+		}
+
+		int sum = 0;
+
+		for (int c = 0; c < alphabetSize; c++) {
+
+			sum += buckets[c];
+			buckets[c] = bucketEnds ? sum : sum - buckets[c];
+		}
+	};
+
+	auto induce = [&]() {
+
+		getBuckets(false);
+
+		for (int i = 0; i < length; i++) {
+
+			int j = suffixArray[i] - 1;
+
+			if (j >= 0 && !sType[j]) {
+
+				suffixArray[buckets[text[j]]++] = j;
+			}
+		}
+
+		getBuckets(true);
+
+		for (int i = length - 1; i >= 0; i--) {
+
+			int j = suffixArray[i] - 1;
+
+			if (j >= 0 && sType[j]) {
+
+				suffixArray[--buckets[text[j]]] = j;
+			}
+		}
+	};
+
+	// Sort the LMS substrings
+	getBuckets(true);
+	fill(suffixArray, suffixArray + length, DEFAULT_NODE_POINTER);
+
+	for (int i = 1; i < length; i++) {
+
+		if (isLms(i)) {
+
+			suffixArray[--buckets[text[i]]] = i;
+		}
+	}
+
+	induce();
+
+	// Name the LMS substrings in sorted order
+	int lmsCount = 0;
+
+	for (int i = 0; i < length; i++) {
+
+		if (isLms(suffixArray[i])) {
+
+			suffixArray[lmsCount++] = suffixArray[i];
+		}
+	}
+
+	fill(suffixArray + lmsCount, suffixArray + length, DEFAULT_NODE_POINTER);
+
+	int nameCount = 0;
+	int previous = DEFAULT_NODE_POINTER;
+
+	for (int i = 0; i < lmsCount; i++) {
+
+		int position = suffixArray[i];
+		bool different = false;
+
+		for (int d = 0; d < length; d++) {
+
+			if (previous == DEFAULT_NODE_POINTER || text[position + d] != text[previous + d] || sType[position + d] != sType[previous + d]) {
+
+				different = true;
+				break;
+			} else if (d > 0 && (isLms(position + d) || isLms(previous + d))) {
+
+				break;
+			}
+		}
+
+		if (different) {
+
+			nameCount++;
+			previous = position;
+		}
+
+		suffixArray[lmsCount + position / 2] = nameCount - 1;
+	}
+
+	for (int i = length - 1, j = length - 1; i >= lmsCount; i--) {
+
+		if (suffixArray[i] >= 0) {
+
+			suffixArray[j--] = suffixArray[i];
+		}
+	}
+
+	// Sort the LMS suffixes, recursing while names repeat
+	int *reducedText = suffixArray + length - lmsCount;
+	int *reducedSuffixArray = suffixArray;
+
+	if (nameCount < lmsCount) {
+
+		buildSuffixArray(reducedText, reducedSuffixArray, lmsCount, nameCount);
+	} else {
+
+		for (int i = 0; i < lmsCount; i++) {
+
+			reducedSuffixArray[reducedText[i]] = i;
+		}
+	}
+
+	// Induce the full suffix array from the sorted LMS suffixes
+	getBuckets(true);
+
+	for (int i = 1, j = 0; i < length; i++) {
+
+		if (isLms(i)) {
+
+			reducedText[j++] = i;
+		}
+	}
+
+	for (int i = 0; i < lmsCount; i++) {
+
+		reducedSuffixArray[i] = reducedText[reducedSuffixArray[i]];
+	}
+
+	fill(suffixArray + lmsCount, suffixArray + length, DEFAULT_NODE_POINTER);
+
+	for (int i = lmsCount - 1; i >= 0; i--) {
+
+		int j = suffixArray[i];
+
+		suffixArray[i] = DEFAULT_NODE_POINTER;
+		suffixArray[--buckets[text[j]]] = j;
+	}
+
+	induce();
+}
+
+/******************************************************************************
+	Name: compressBwtBlock
+
+	Des:
+		Code one block with the Burrows-Wheeler transform, move-to-front,
+		zero run coding and a huffman table. The payload holds the row of the
+		original string, the number of symbols, the table and the bits
+
+	Params:
+		data - type const unsigned char *, the block
+		dataLength - type int, the length of the block
+
+	Returns:
+		type vector<unsigned char>, the block payload
+******************************************************************************/
+vector<unsigned char> compressBwtBlock(const unsigned char *data, int dataLength) {
+
+	// The sentinel sorts first, so the rotation starting with it is row 0
+	vector<int> text(dataLength + 1);
+	vector<int> suffixArray(dataLength + 1);
+
+	for (int i = 0; i < dataLength; i++) {
+
+		text[i] = data[i] + 1;
+	}
+
+	text[dataLength] = 0;
+
+	buildSuffixArray(text.data(), suffixArray.data(), dataLength + 1, BYTE_GLYPHS + 1);
+
+	int primaryIndex = 0;
+	vector<unsigned char> transformed;
+	transformed.reserve(dataLength);
+
+	for (int i = 0; i <= dataLength; i++) {
+
+		if (suffixArray[i] == 0) {
+
+			primaryIndex = i;
+		} else {
+
+			transformed.push_back(data[suffixArray[i] - 1]);
+		}
+	}
+
+	unsigned char order[BYTE_GLYPHS];
+
+	for (int i = 0; i < BYTE_GLYPHS; i++) {
+
+		order[i] = (unsigned char)i;
+	}
+
+	vector<short> symbols;
+	symbols.reserve(dataLength);
+
+	int zeroRun = 0;
+
+	auto writeZeroRun = [&]() {
+
+		while (zeroRun > 0) {
+
+			zeroRun--;
+			symbols.push_back((zeroRun & 1) ? BWT_RUN_B : BWT_RUN_A);
+			zeroRun >>= 1;
+		}
+	};
+
+	for (int i = 0; i < dataLength; i++) {
+
+		unsigned char glyph = transformed[i];
+		int index = 0;
+
+		while (order[index] != glyph) {
+
+			index++;
+		}
+
+		if (index == 0) {
+
+			zeroRun++;
+			continue;
+		}
+
+		writeZeroRun();
+
+		memmove(order + 1, order, index);
+		order[0] = glyph;
+
+		symbols.push_back((short)(index + 1));
+	}
+
+	writeZeroRun();
+
+	int frequencyTable[MAX_GLYPHS] = { 0 };
+
+	for (int i = 0; i < (int)symbols.size(); i++) {
+
+		frequencyTable[symbols[i]]++;
+	}
+
+	unsigned char codeLengths[MAX_GLYPHS];
+	string bitcodeArray[MAX_GLYPHS];
+
+	generateCodeLengths(frequencyTable, codeLengths, MAX_BLOCK_CODE_LENGTH);
+	generateCanonicalBitcodes(codeLengths, bitcodeArray);
+
+	int symbolCount = (int)symbols.size();
+	vector<unsigned char> payload(2 * sizeof(int));
+
+	memcpy(payload.data(), &primaryIndex, sizeof(int));
+	memcpy(payload.data() + sizeof(int), &symbolCount, sizeof(int));
+
+	writeCompactCodeLengths(payload, codeLengths, MAX_GLYPHS);
+
+	BitWriter writer;
+
+	for (int i = 0; i < (int)symbols.size(); i++) {
+
+		writeBitcode(writer, bitcodeArray[symbols[i]]);
+	}
+
+	payload.insert(payload.end(), writer.bytes.begin(), writer.bytes.end());
+
+	return payload;
+}
+
+/******************************************************************************
+	Name: countHuffmanBlock
+
+	Des:
+		Count a block for its huffman table. A sampled count takes a few
+		chunks of the block and gives every byte value a code, so the data is
+		only read once, by the encoder, and its coded length is not known
+		until the encoder is done
+
+	Params:
+		data - type const unsigned char *, the block
+		dataLength - type int, the length of the block
+		sampleHistogram - type bool, true to count samples only
+		oFrequencyTable - type int[MAX_GLYPHS], the zeroed frequencies
+******************************************************************************/
+void countHuffmanBlock(const unsigned char *data, int dataLength, bool sampleHistogram, int oFrequencyTable[MAX_GLYPHS]) {
+
+	if (!sampleHistogram) {
+
+		countGlyphs(data, dataLength, oFrequencyTable);
+		return;
+	}
+
+	for (int chunk = 0; chunk < dataLength; chunk += FAST_SAMPLE_STRIDE) {
+
+		countGlyphs(data + chunk, min(FAST_SAMPLE_CHUNK_SIZE, dataLength - chunk), oFrequencyTable);
+	}
+
+	for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+		oFrequencyTable[glyph]++;
+	}
+}
+
+/******************************************************************************
+	Name: chooseHuffmanTables
+
+	Des:
+		Build each block's length limited huffman table, then pick block by
+		block whether to store it, reuse the table of the block before or
+		store only the lengths that changed, whichever makes the block
+		smallest. Only the previous block's table is needed, so the choice
+		works the same a block at a time. Sampled counts can not tell what a
+		block costs, so those blocks always store their own table
+
+	Params:
+		data - type const unsigned char *, the data
+		blockStarts - type const vector<int> &, the start of each block
+			followed by the data length
+		frequencyTables - type vector<int> &, MAX_GLYPHS frequencies for
+			each block, counted here if empty
+		sampleHistogram - type bool, true if the counts are sampled
+		carriedLengths - type const unsigned char *, the code lengths of the
+			huffman block written before these, nullptr if there is none
+		oBlockTypes - type vector<int> &, the type chosen for each block
+		oCodeLengths - type vector<unsigned char> &, MAX_GLYPHS code lengths
+			each block is coded with
+		oPayloads - type vector<vector<unsigned char>> &, each block's table
+******************************************************************************/
+void chooseHuffmanTables(const unsigned char *data, const vector<int> &blockStarts, vector<int> &frequencyTables, bool sampleHistogram, const unsigned char *carriedLengths, vector<int> &oBlockTypes, vector<unsigned char> &oCodeLengths, vector<vector<unsigned char>> &oPayloads) {
+
+	const int blockCount = (int)blockStarts.size() - 1;
+	const bool counted = !frequencyTables.empty();
+
+	frequencyTables.resize((size_t)blockCount * MAX_GLYPHS, 0);
+	oCodeLengths.assign((size_t)blockCount * MAX_GLYPHS, 0);
+
+	atomic<int> remainingBlocks(blockCount);
+
+	auto buildTable = [&](int i) {
+
+		int *frequencyTable = &frequencyTables[(size_t)i * MAX_GLYPHS];
+
+		if (!counted) {
+
+			countHuffmanBlock(data + blockStarts[i], blockStarts[i + 1] - blockStarts[i], sampleHistogram, frequencyTable);
+		}
+
+		generateCodeLengths(frequencyTable, &oCodeLengths[(size_t)i * MAX_GLYPHS], MAX_BLOCK_CODE_LENGTH);
+
+		remainingBlocks--;
+	};
+
+	for (int i = blockCount - 1; i > 0; i--) {
+
+		submitPoolTask([&buildTable, i]() { buildTable(i); });
+	}
+
+	if (blockCount > 0) {
+
+		buildTable(0);
+	}
+
+	waitForPoolTasks(remainingBlocks);
+
+	for (int i = 0; i < blockCount; i++) {
+
+		const int *frequencyTable = &frequencyTables[(size_t)i * MAX_GLYPHS];
+		unsigned char *codeLengths = &oCodeLengths[(size_t)i * MAX_GLYPHS];
+		const unsigned char *previousLengths = i > 0 ? codeLengths - MAX_GLYPHS : carriedLengths;
+
+		oBlockTypes[i] = BLOCK_HUFFMAN;
+
+		if (previousLengths != nullptr && !sampleHistogram) {
+
+			long long ownBits = getCodedBitLength(frequencyTable, codeLengths);
+			long long tableSize = getCompactCodeLengthsSize(codeLengths, BYTE_GLYPHS);
+			long long patchSize = getCodeLengthChangesSize(previousLengths, codeLengths);
+			long long cheapestSize = tableSize + (ownBits + BYTE_SIZE - 1) / BYTE_SIZE;
+			bool reusable = true;
+
+			for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+				reusable = reusable && (frequencyTable[glyph] == 0 || previousLengths[glyph] > 0);
+			}
+
+			if (patchSize < tableSize) {
+
+				oBlockTypes[i] = BLOCK_HUFFMAN_PATCH;
+				cheapestSize = patchSize + (ownBits + BYTE_SIZE - 1) / BYTE_SIZE;
+			}
+
+			if (reusable && (getCodedBitLength(frequencyTable, previousLengths) + BYTE_SIZE - 1) / BYTE_SIZE <= cheapestSize) {
+
+				oBlockTypes[i] = BLOCK_HUFFMAN_REUSE;
+				copy(previousLengths, previousLengths + MAX_GLYPHS, codeLengths);
+			}
+		}
+
+		if (oBlockTypes[i] == BLOCK_HUFFMAN) {
+
+			writeCompactCodeLengths(oPayloads[i], codeLengths, BYTE_GLYPHS);
+		} else if (oBlockTypes[i] == BLOCK_HUFFMAN_PATCH) {
+
+			writeCodeLengthChanges(oPayloads[i], previousLengths, codeLengths);
+		}
+	}
+}
+
+/******************************************************************************
+	Name: appendHuffmanBits
+
+	Des:
+		Code one block with the code lengths chosen for it and append the
+		bits to its payload. With sampled counts the output is sized for the
+		longest codes and cut down to what the encoder wrote
+
+	Params:
+		payload - type vector<unsigned char> &, the block's table
+		data - type const unsigned char *, the block
+		dataLength - type int, the length of the block
+		frequencyTable - type const int *, the block's frequencies
+		codeLengths - type const unsigned char *, the code lengths
+		sampleHistogram - type bool, true if the counts are sampled
+******************************************************************************/
+void appendHuffmanBits(vector<unsigned char> &payload, const unsigned char *data, int dataLength, const int *frequencyTable, const unsigned char *codeLengths, bool sampleHistogram) {
+
+	string bitcodeArray[MAX_GLYPHS];
+
+	generateCanonicalBitcodes(codeLengths, bitcodeArray);
+
+	if (sampleHistogram) {
+
+		PackedCode packedCodes[MAX_GLYPHS];
+		size_t tableLength = payload.size();
+		int boundLength = (int)(((long long)dataLength * MAX_BLOCK_CODE_LENGTH + BYTE_SIZE - 1) / BYTE_SIZE);
+
+		packBitcodes(bitcodeArray, packedCodes);
+		payload.resize(tableLength + boundLength);
+		payload.resize(tableLength + encodeWithKernel(packedCodes, data, dataLength, payload.data() + tableLength, boundLength));
+
+		return;
+	}
+
+	// The EOF glyph has no code here, so compressData adds nothing after the data
+	int compressedDataLength = (int)((getCodedBitLength(frequencyTable, codeLengths) + BYTE_SIZE - 1) / BYTE_SIZE);
+
+	unsigned char *compressedData = compressData(bitcodeArray, (char *)data, dataLength, compressedDataLength);
+
+	payload.insert(payload.end(), compressedData, compressedData + compressedDataLength);
+
+	delete[] compressedData;
+}
+
+/******************************************************************************
+	Name: getEntropyBits
+
+	Des:
+		Work out the bits an ideal code built for a histogram would take to
+		code it
+
+	Params:
+		frequencyTable - type const int *, the frequency of each byte
+		total - type int, the sum of the frequencies
+
+	Returns:
+		type double, the number of bits
+******************************************************************************/
+double getEntropyBits(const int *frequencyTable, int total) {
+
+	double bits = total * log2((double)max(total, 1));
+
+	for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+		if (frequencyTable[glyph] > 0) {
+
+			bits -= frequencyTable[glyph] * log2((double)frequencyTable[glyph]);
+		}
+	}
+
+	return bits;
+}
+
+/******************************************************************************
+	Name: planBlockSplits
+
+	Des:
+		Choose where huffman blocks start. Every segment is counted, the
+		segments split between pool tasks, and then each segment either
+		joins the current block or starts a new one, whichever the entropy
+		of the histograms says is cheaper once a new block has paid for its
+		header and table. Blocks are never longer than the block size, and
+		each block's histogram is kept so it is not counted again
+
+	Params:
+		data - type const unsigned char *, the data
+		dataLength - type int, the length of the data
+		blockSize - type int, the longest block allowed
+		oBlockStarts - type vector<int> &, the start of each block followed
+			by the data length
+		oFrequencyTables - type vector<int> &, MAX_GLYPHS frequencies for
+			each block
+******************************************************************************/
+void planBlockSplits(const unsigned char *data, int dataLength, int blockSize, vector<int> &oBlockStarts, vector<int> &oFrequencyTables) {
+
+	const int segmentCount = (dataLength + SPLIT_SEGMENT_SIZE - 1) / SPLIT_SEGMENT_SIZE;
+
+	vector<int> segmentFrequencies((size_t)segmentCount * BYTE_GLYPHS, 0);
+	atomic<int> remainingTasks(0);
+
+	auto countSegments = [&](int first) {
+
+		for (int segment = first; segment < min(first + SPLIT_TASK_SEGMENTS, segmentCount); segment++) {
+
+			int segmentStart = segment * SPLIT_SEGMENT_SIZE;
+
+			countGlyphs(data + segmentStart, min(SPLIT_SEGMENT_SIZE, dataLength - segmentStart), &segmentFrequencies[(size_t)segment * BYTE_GLYPHS]);
+		}
+
+		remainingTasks--;
+	};
+
+	remainingTasks = (segmentCount + SPLIT_TASK_SEGMENTS - 1) / SPLIT_TASK_SEGMENTS;
+
+	for (int first = SPLIT_TASK_SEGMENTS; first < segmentCount; first += SPLIT_TASK_SEGMENTS) {
+
+		submitPoolTask([&countSegments, first]() { countSegments(first); });
+	}
+
+	if (segmentCount > 0) {
+
+		countSegments(0);
+	}
+
+	waitForPoolTasks(remainingTasks);
+
+	oBlockStarts.clear();
+	oFrequencyTables.clear();
+
+	int blockLength = 0;
+	double blockBits = 0;
+
+	for (int segment = 0; segment < segmentCount; segment++) {
+
+		const int *segmentTable = &segmentFrequencies[(size_t)segment * BYTE_GLYPHS];
+		int segmentStart = segment * SPLIT_SEGMENT_SIZE;
+		int segmentLength = min(SPLIT_SEGMENT_SIZE, dataLength - segmentStart);
+		double segmentBits = getEntropyBits(segmentTable, segmentLength);
+		bool newBlock = blockLength == 0 || blockLength + segmentLength > blockSize;
+
+		if (!newBlock) {
+
+			int *blockTable = &oFrequencyTables[oFrequencyTables.size() - MAX_GLYPHS];
+			int mergedTable[BYTE_GLYPHS];
+			double tableBits = SPLIT_BLOCK_OVERHEAD_BITS;
+
+			for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+				mergedTable[glyph] = blockTable[glyph] + segmentTable[glyph];
+				tableBits += segmentTable[glyph] > 0 ? SPLIT_CODE_LENGTH_BITS : 0;
+			}
+
+			double mergedBits = getEntropyBits(mergedTable, blockLength + segmentLength);
+
+			newBlock = blockBits + segmentBits + tableBits < mergedBits;
+
+			if (!newBlock) {
+
+				copy(mergedTable, mergedTable + BYTE_GLYPHS, blockTable);
+				blockLength += segmentLength;
+				blockBits = mergedBits;
+			}
+		}
+
+		if (newBlock) {
+
+			oBlockStarts.push_back(segmentStart);
+			oFrequencyTables.insert(oFrequencyTables.end(), segmentTable, segmentTable + BYTE_GLYPHS);
+			oFrequencyTables.resize(oFrequencyTables.size() + MAX_GLYPHS - BYTE_GLYPHS, 0);
+			blockLength = segmentLength;
+			blockBits = segmentBits;
+		}
+	}
+
+	oBlockStarts.push_back(dataLength);
+}
+
+/******************************************************************************
+	Name: getBlockType
+
+	Des:
+		Pick the block type for the selected mode when data is coded a block
+		at a time, by a compression stream or an append, in the same order
+		of precedence as printOutput
+
+	Params:
+		options - type const CompressionOptions &, the selected mode
+
+	Returns:
+		type int, the block type
+******************************************************************************/
+int getBlockType(const CompressionOptions &options) {
+
+	if (options.dictionary != nullptr) {
+
+		return BLOCK_DICTIONARY;
+	} else if (options.order1) {
+
+		return BLOCK_ORDER1;
+	} else if (options.lz) {
+
+		return BLOCK_LZ;
+	} else if (options.bwt) {
+
+		return BLOCK_BWT;
+	}
+
+	return BLOCK_HUFFMAN;
+}
+
+/******************************************************************************
+	Name: writeBlocks
+
+	Des:
+		Write the data as blocks, each coded with its own huffman table,
+		with the BWT pipeline, with the dictionary, order-1 or LZ coding the
+		options select, or stored as it is. Huffman blocks start where
+		planBlockSplits chooses unless options turn splitting off, other
+		blocks every blockSize bytes, and chooseHuffmanTables picks how each
+		huffman block stores its table. Each block and its checksum is a
+		task in the pool, and the blocks are written in order once they are
+		all done
+
+	Params:
+		fout - type ostream &, the stream the blocks are written to
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		blockType - type int, a type from getBlockType or BLOCK_STORED
+		options - type const CompressionOptions &, the block size, how
+			huffman tables are built and the dictionary or LZ settings
+		carriedLengths - type vector<unsigned char> *, the code lengths of
+			the huffman block written before these, empty if there is none,
+			left holding those of the last block written. nullptr when the
+			first block must store its own table
+
+	Returns:
+		type vector<int>, the start of each block followed by the data length
+******************************************************************************/
+vector<int> writeBlocks(ostream &fout, char *data, int dataLength, int blockType, const CompressionOptions &options, vector<unsigned char> *carriedLengths) {
+
+	const int blockSize = max(1, min(options.blockSize, MAX_BLOCK_SIZE));
+
+	vector<int> blockStarts;
+	vector<int> frequencyTables;
+
+	if (blockType == BLOCK_HUFFMAN && options.splitBlocks && !options.sampleHistogram && blockSize >= SPLIT_SEGMENT_SIZE) {
+
+		planBlockSplits((unsigned char *)data, dataLength, blockSize, blockStarts, frequencyTables);
+	} else {
+
+		for (int start = 0; start < dataLength; start += min(blockSize, dataLength - start)) {
+
+			blockStarts.push_back(start);
+		}
+
+		blockStarts.push_back(dataLength);
+	}
+
+	const int blockCount = (int)blockStarts.size() - 1;
+
+	vector<vector<unsigned char>> payloads(blockCount);
+	vector<unsigned int> checksums(blockCount);
+	vector<int> blockTypes(blockCount, blockType);
+	vector<unsigned char> codeLengths;
+
+	if (blockType == BLOCK_HUFFMAN) {
+
+		bool carried = carriedLengths != nullptr && !carriedLengths->empty();
+
+		chooseHuffmanTables((unsigned char *)data, blockStarts, frequencyTables, options.sampleHistogram, carried ? carriedLengths->data() : nullptr, blockTypes, codeLengths, payloads);
+
+		if (carriedLengths != nullptr && blockCount > 0) {
+
+			carriedLengths->assign(codeLengths.end() - MAX_GLYPHS, codeLengths.end());
+		}
+	}
+
+	atomic<int> remainingBlocks(blockCount);
+
+	auto compressBlock = [&](int i) {
+
+		const unsigned char *block = (unsigned char *)data + blockStarts[i];
+		int blockLength = blockStarts[i + 1] - blockStarts[i];
+
+		checksums[i] = ~updateCrc(CRC_INITIAL, block, blockLength);
+
+		if (blockType == BLOCK_STORED) {
+
+			payloads[i].assign(block, block + blockLength);
+		} else if (blockType == BLOCK_BWT) {
+
+			payloads[i] = compressBwtBlock(block, blockLength);
+		} else if (blockType == BLOCK_DICTIONARY) {
+
+			payloads[i] = compressDictionaryBlock((char *)block, blockLength, *options.dictionary);
+		} else if (blockType == BLOCK_ORDER1) {
+
+			payloads[i] = compressOrder1Block((char *)block, blockLength);
+		} else if (blockType == BLOCK_LZ) {
+
+			payloads[i] = compressLzBlock((char *)block, blockLength, options);
+		} else {
+
+			appendHuffmanBits(payloads[i], block, blockLength, &frequencyTables[(size_t)i * MAX_GLYPHS], &codeLengths[(size_t)i * MAX_GLYPHS], options.sampleHistogram);
+		}
+
+		remainingBlocks--;
+	};
+
+	// The first block is kept for this thread, which then helps with the rest
+	for (int i = blockCount - 1; i > 0; i--) {
+
+		submitPoolTask([&compressBlock, i]() { compressBlock(i); });
+	}
+
+	if (blockCount > 0) {
+
+		compressBlock(0);
+	}
+
+	waitForPoolTasks(remainingBlocks);
+
+	for (int i = 0; i < blockCount; i++) {
+
+		writeBlockHeader(fout, blockTypes[i], blockStarts[i + 1] - blockStarts[i], (int)payloads[i].size(), checksums[i]);
+		fout.write((char *)payloads[i].data(), payloads[i].size());
+	}
+
+	return blockStarts;
+}
+
+/******************************************************************************
+	Name: printBlockOutput
+
+	Des:
+		Write the data as a block format huf file, noting where the blocks
+		start in the stats when huffman blocks were split
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		blockType - type int, BLOCK_HUFFMAN, BLOCK_BWT or BLOCK_STORED
+		options - type const CompressionOptions &, the block size and how
+			huffman tables are built
+******************************************************************************/
+void printBlockOutput(ostream &fout, string &fileName, char *data, int dataLength, int blockType, const CompressionOptions &options) {
+
+	writeBlockFileHeader(fout, fileName);
+
+	vector<int> blockStarts = writeBlocks(fout, data, dataLength, blockType, options, nullptr);
+
+	if (options.stats != nullptr && blockType == BLOCK_HUFFMAN && options.splitBlocks && blockStarts.size() > 2) {
+
+		lock_guard<mutex> guard(options.stats->splitLock);
+
+		options.stats->blockSplits.push_back(make_pair(fileName, vector<int>(blockStarts.begin() + 1, blockStarts.end() - 1)));
+	}
+
+	writeBlockFileFooter(fout, ~updateCrc(CRC_INITIAL, data, dataLength));
+}
+
+/******************************************************************************
+	Name: getSampleEntropy
+
+	Des:
+		Work out the order-0 entropy of the start of the data from a
+		histogram of its first bytes
+
+	Params:
+		data - type const unsigned char *, the data
+		dataLength - type int, the length of the data
+
+	Returns:
+		type double, the entropy in bits per byte
+******************************************************************************/
+double getSampleEntropy(const unsigned char *data, int dataLength) {
+
+	int sampleLength = min(dataLength, ENTROPY_SAMPLE_SIZE);
+	int frequencyTable[MAX_GLYPHS] = { 0 };
+	double entropy = 0;
+
+	countGlyphs(data, sampleLength, frequencyTable);
+
+	for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+		if (frequencyTable[glyph] > 0) {
+
+			double probability = (double)frequencyTable[glyph] / sampleLength;
+
+			entropy -= probability * log2(probability);
+		}
+	}
+
+	return entropy;
+}
+
+/******************************************************************************
+	Name: printOutput
+
+	Des:
+		Write the compressed huf image of the data to a stream in the format
+		chosen by the options. Data that already looks compressed is stored
+		in blocks instead, unless the legacy format is asked for or the file
+		is coded against a reference
+
+	Params:
+		fout - type ostream &, the stream the huf image is written to
+		fileName - type string &, the name of the original file
+		data - type char *, the original data
+		dataLength - type int, the length of the original data
+		options - type CompressionOptions &, the selected compression mode
+******************************************************************************/
+void printOutput(ostream &fout, string &fileName, char *data, int dataLength, CompressionOptions &options) {
+
+	// A revision of compressed data can still share most of its bytes with
+	// the reference, so the entropy check does not apply
+	if (options.reference != nullptr) {
+
+		printDeltaOutput(fout, fileName, data, dataLength, options);
+	} else if (!options.legacy && getSampleEntropy((unsigned char *)data, dataLength) >= options.skipEntropy) {
+
+		printBlockOutput(fout, fileName, data, dataLength, BLOCK_STORED, options);
+
+		if (options.stats != nullptr) {
+
+			options.stats->skippedBytes += dataLength;
+			options.stats->skippedFiles++;
+		}
+	} else if (options.dictionary != nullptr) {
+
+		printDictionaryOutput(fout, fileName, data, dataLength, *options.dictionary);
+	} else if (options.order1) {
+
+		printOrder1Output(fout, fileName, data, dataLength);
+	} else if (options.lz) {
+
+		printLzOutput(fout, fileName, data, dataLength, options);
+	} else if (options.legacy) {
+
+		printHuffmanOutput(fout, fileName, data, dataLength);
+	} else {
+
+		printBlockOutput(fout, fileName, data, dataLength, options.bwt ? BLOCK_BWT : BLOCK_HUFFMAN, options);
+	}
+}
+
+/******************************************************************************
+	Name: compressFile
+
+	Des:
+		Compress a file into a huf image written to a stream
+
+	Params:
+		fileName - type string &, the name of the file
+		fout - type ostream &, the stream the huf image is written to
+		oDataLength - type int &, the length of the original data
+		options - type CompressionOptions &, the selected compression mode
+
+	Returns:
+		type bool, false if the file could not be read
+******************************************************************************/
+bool compressFile(string &fileName, ostream &fout, int &oDataLength, CompressionOptions &options) {
+
+	char *data = readFile(fileName, oDataLength);
+
+	if (data == nullptr) {
+
+		return false;
+	}
+
+	printOutput(fout, fileName, data, oDataLength, options);
+
+	delete[] data;
+
+	return true;
+}
+
+/******************************************************************************
+	Name: getHufFileName
+
+	Des:
+		Work out where the huf file for an input goes. Without an output
+		directory it sits next to the input, otherwise it goes under the
+		output directory at the input's relative path
+
+	Params:
+		inputFile - type const InputFile &, the input
+		outputDirectory - type const string &, the output directory, or empty
+
+	Returns:
+		type string, the name of the huf file
+******************************************************************************/
+string getHufFileName(const InputFile &inputFile, const string &outputDirectory) {
+
+	const string hufFileExtension = ".huf";
+
+	filesystem::path outputPath = outputDirectory.empty() ? filesystem::path(inputFile.path) : filesystem::path(outputDirectory) / inputFile.relativePath;
+
+	return outputPath.replace_extension(hufFileExtension).string();
+}
+
+/******************************************************************************
+	Name: getHufFileNames
+
+	Des:
+		Work out the huf file for every input with getHufFileName. Inputs
+		that would share a huf file, like foo.cpp and foo.h, are reported
+		and given an empty name instead, so two tasks never write the same
+		file
+
+	Params:
+		inputFiles - type const vector<InputFile> &, the inputs
+		outputDirectory - type const string &, the output directory, or empty
+
+	Returns:
+		type vector<string>, the name of each input's huf file, or empty
+******************************************************************************/
+vector<string> getHufFileNames(const vector<InputFile> &inputFiles, const string &outputDirectory) {
+
+	vector<string> outputFileNames(inputFiles.size());
+	vector<pair<string, int>> sortedNames;
+
+	for (int i = 0; i < (int)inputFiles.size(); i++) {
+
+		outputFileNames[i] = getHufFileName(inputFiles[i], outputDirectory);
+
+		// Standard input goes to standard output, not to a file
+		if (inputFiles[i].path != "-") {
+
+			sortedNames.push_back({ filesystem::path(outputFileNames[i]).lexically_normal().string(), i });
+		}
+	}
+
+	sort(sortedNames.begin(), sortedNames.end());
+
+	for (int i = 0; i < (int)sortedNames.size(); i++) {
+
+		bool collides = (i > 0 && sortedNames[i].first == sortedNames[i - 1].first) || (i + 1 < (int)sortedNames.size() && sortedNames[i].first == sortedNames[i + 1].first);
+
+		if (collides) {
+
+			cout << "Unable to compress " << inputFiles[sortedNames[i].second].path << ", another input also goes to " << sortedNames[i].first << endl;
+			outputFileNames[sortedNames[i].second].clear();
+		}
+	}
+
+	return outputFileNames;
+}
+
+/******************************************************************************
+	Name: compressToHufFile
+
+	Des:
+		Compress a file into a huf file, creating the directories the huf
+		file goes in
+
+	Params:
+		fileName - type string &, the file to compress
+		outputFileName - type const string &, the huf file to write
+		options - type CompressionOptions &, the selected compression mode
+
+	Returns:
+		type bool, false if the file could not be read or written
+******************************************************************************/
+bool compressToHufFile(string &fileName, const string &outputFileName, CompressionOptions &options) {
+
+	int dataLength;
+
+	char *data = readFile(fileName, dataLength);
+
+	if (data == nullptr) {
+
+		return false;
+	}
+
+	error_code error;
+	filesystem::path outputDirectory = filesystem::path(outputFileName).parent_path();
+
+	if (!outputDirectory.empty()) {
+
+		filesystem::create_directories(outputDirectory, error);
+	}
+
+	ofstream fout(outputFileName, ios::out | ios::binary);
+
+	if (fout.is_open()) {
+
+		printOutput(fout, fileName, data, dataLength, options);
+	}
+
+	bool written = fout.is_open() && fout.good();
+
+	fout.close();
+
+	delete[] data;
+
+	return written;
+}
+
+/******************************************************************************
+	Name: syncFile
+
+	Des:
+		Wait for everything written to a file to reach the disk, so nothing
+		written after it can get there first
+
+	Params:
+		fileName - type const string &, the file
+
+	Returns:
+		type bool, false if the file could not be opened or synced
+******************************************************************************/
+bool syncFile(const string &fileName) {
+
+#ifdef _WIN32
+	int descriptor = _open(fileName.c_str(), _O_RDWR | _O_BINARY);
+	bool synced = descriptor >= 0 && _commit(descriptor) == 0;
+
+	if (descriptor >= 0) {
+
+		_close(descriptor);
+	}
+#else
+	int descriptor = open(fileName.c_str(), O_RDWR);
+	bool synced = descriptor >= 0 && fsync(descriptor) == 0;
+
+	if (descriptor >= 0) {
+
+		close(descriptor);
+	}
+#endif
+
+	return synced;
+}
+
+/******************************************************************************
+	Name: appendToHufFile
+
+	Des:
+		Bring a block format huf file up to date with a file that has grown,
+		compressing only the bytes added since it was last written. The
+		block headers are walked to find how much of the file is already
+		stored, and the last stored block is checked against the file to be
+		sure it is the same file. The new blocks, end block and checksum are
+		written after the old end block and checksum and synced to the disk,
+		and only then is the old end block overwritten with BLOCK_APPENDED.
+		Until that single int is written the huf file still decodes to what
+		it held before, so an append that fails part way, even to a power
+		cut, loses nothing. The new blocks are coded in the selected mode,
+		or stored when they look compressed already. A huf file that does
+		not exist yet is written in full
+
+	Params:
+		fileName - type string &, the file that has grown
+		outputFileName - type const string &, its block format huf file
+		options - type CompressionOptions &, the selected compression mode
+
+	Returns:
+		type bool, false if either file could not be read or written, the
+			huf file is not in the block format or the file no longer
+			matches it
+******************************************************************************/
+bool appendToHufFile(string &fileName, const string &outputFileName, CompressionOptions &options) {
+
+	error_code error;
+
+	if (!filesystem::exists(outputFileName, error)) {
+
+		return compressToHufFile(fileName, outputFileName, options);
+	}
+
+	fstream huf(outputFileName, ios::in | ios::out | ios::binary);
+
+	int magic = 0;
+	int fileNameLength = 0;
+
+	huf.read((char *)& magic, sizeof(int));
+	huf.read((char *)& fileNameLength, sizeof(int));
+
+	if (!huf || magic != BLOCK_FILE_MAGIC || fileNameLength < 0) {
+
+		cout << "Unable to append to " + outputFileName + ", it is not a block format huf file\n";
+		return false;
+	}
+
+	huf.seekg(fileNameLength, ios::cur);
+
+	long long storedLength = 0;
+	int lastRawLength = 0;
+	unsigned int lastChecksum = 0;
+	int blockType = BLOCK_END;
+
+	huf.read((char *)& blockType, sizeof(int));
+
+	while (huf && blockType != BLOCK_END) {
+
+		if (blockType == BLOCK_APPENDED) {
+
+			huf.seekg(sizeof(int), ios::cur);
+		} else {
+
+			int payloadLength = 0;
+
+			huf.read((char *)& lastRawLength, sizeof(int));
+			huf.read((char *)& payloadLength, sizeof(int));
+			huf.read((char *)& lastChecksum, sizeof(int));
+			huf.seekg(payloadLength, ios::cur);
+
+			storedLength += lastRawLength;
+		}
+
+		huf.read((char *)& blockType, sizeof(int));
+	}
+
+	long long endBlockPosition = (long long)huf.tellg() - (long long)sizeof(int);
+	unsigned int fileChecksum = 0;
+
+	huf.read((char *)& fileChecksum, sizeof(int));
+
+	if (!huf) {
+
+		cout << "Unable to append to " + outputFileName + ", it is damaged\n";
+		return false;
+	}
+
+	ifstream fin(fileName, ios::in | ios::binary | ios::ate);
+
+	if (!fin.is_open()) {
+
+		return false;
+	}
+
+	long long fileLength = (long long)fin.tellg();
+
+	if (fileLength < storedLength || fileLength - storedLength > INT_MAX) {
+
+		cout << "Unable to append " + fileName + ", it is shorter than " + outputFileName + " or too much has been added\n";
+		return false;
+	}
+
+	// A file that was replaced rather than appended to is very unlikely to
+	// match the last block, and checking it reads one block instead of all
+	vector<char> lastBlock(lastRawLength);
+
+	fin.seekg(storedLength - lastRawLength);
+	fin.read(lastBlock.data(), lastRawLength);
+
+	if (!fin || ~updateCrc(CRC_INITIAL, lastBlock.data(), lastRawLength) != lastChecksum) {
+
+		cout << "Unable to append " + fileName + ", it has changed since " + outputFileName + " was written\n";
+		return false;
+	}
+
+	int dataLength = (int)(fileLength - storedLength);
+
+	if (dataLength == 0) {
+
+		return true;
+	}
+
+	char *data = new char[dataLength];
+
+	fin.read(data, dataLength);
+
+	bool written = false;
+
+	if (fin) {
+
+		int appendedBlockType = getBlockType(options);
+
+		if (getSampleEntropy((unsigned char *)data, dataLength) >= options.skipEntropy) {
+
+			appendedBlockType = BLOCK_STORED;
+		}
+
+		// The file checksum is carried on from the stored data, which is
+		// never read back
+		unsigned int newFileChecksum = ~updateCrc(~fileChecksum, data, dataLength);
+
+		huf.seekp(endBlockPosition + 2 * sizeof(int));
+		writeBlocks(huf, data, dataLength, appendedBlockType, options, nullptr);
+		writeBlockFileFooter(huf, newFileChecksum);
+
+		long long newLength = (long long)huf.tellp();
+
+		huf.flush();
+
+		// Without the sync the marker could reach the disk before the
+		// blocks it commits
+		if (huf && syncFile(outputFileName)) {
+
+			huf.seekp(endBlockPosition);
+			huf.write((char *)& BLOCK_APPENDED, sizeof(int));
+			huf.flush();
+
+			written = huf.good() && syncFile(outputFileName);
+		}
+
+		huf.close();
+
+		// Anything past the new end was left by an append that never
+		// finished
+		if (written && (long long)filesystem::file_size(outputFileName, error) > newLength) {
+
+			filesystem::resize_file(outputFileName, newLength, error);
+		}
+	}
+
+	delete[] data;
+
+	return written;
+}
+
+/******************************************************************************
+	Name: findInputFiles
+
+	Des:
+		List the files named on the command line, searching directories
+		recursively. Huf files found in directories are left out so a tree
+		can be compressed more than once. A file's relative path starts with
+		the name of the directory it was found under
+
+	Params:
+		paths - type vector<string> &, the files and directories given
+
+	Returns:
+		type vector<InputFile>, the files found
+******************************************************************************/
+vector<InputFile> findInputFiles(vector<string> &paths) {
+
+	const string hufFileExtension = ".huf";
+
+	vector<InputFile> inputFiles;
+
+	for (int i = 0; i < (int)paths.size(); i++) {
+
+		error_code error;
+		filesystem::path root(paths[i]);
+
+		if (paths[i] == "-" || !filesystem::is_directory(root, error)) {
+
+			inputFiles.push_back(InputFile{ paths[i], root.filename().string() });
+			continue;
+		}
+
+		filesystem::path rootName = root.has_filename() ? root.filename() : root.parent_path().filename();
+
+		for (filesystem::recursive_directory_iterator entry(root, error), end; !error && entry != end; entry.increment(error)) {
+
+			if (entry->is_regular_file(error) && entry->path().extension() != hufFileExtension) {
+
+				filesystem::path relativePath = rootName / filesystem::relative(entry->path(), root, error);
+
+				inputFiles.push_back(InputFile{ entry->path().string(), relativePath.string() });
+			}
+		}
+
+		if (error) {
+
+			cout << "Unable to read all of " << paths[i] << endl;
+		}
+	}
+
+	return inputFiles;
+}
+
+/******************************************************************************
+	Name: writeArchive
+
+	Des:
+		Compress several files into one archive. Each entry is compressed by
+		a task in the pool and written in order as soon as it is ready,
+		followed by a directory of the entries and a footer locating it
+
+	Params:
+		archiveName - type string &, the name of the archive to write
+		fileNames - type vector<string> &, the files to add
+		options - type CompressionOptions &, the selected compression mode
+
+	Returns:
+		type bool, false if the archive could not be opened
+******************************************************************************/
+bool writeArchive(string &archiveName, vector<string> &fileNames, CompressionOptions &options) {
+
+	ofstream fout(archiveName, ios::out | ios::binary);
+
+	if (!fout.is_open()) {
+
+		return false;
+	}
+
+	const int fileCount = (int)fileNames.size();
+
+	vector<ArchiveEntry> directory;
+	directory.reserve(fileCount);
+
+	vector<string> images(fileCount);
+	vector<int> originalLengths(fileCount);
+	vector<char> compressed(fileCount);
+	unique_ptr<atomic<int>[]> remaining(new atomic<int>[fileCount]);
+
+	// Submitted last to first, so this thread's own queue gives it the
+	// entries in the order they are written
+	for (int i = fileCount - 1; i >= 0; i--) {
+
+		remaining[i] = 1;
+
+		submitPoolTask([&, i]() {
+
+			ostringstream image;
+
+			compressed[i] = compressFile(fileNames[i], image, originalLengths[i], options);
+			images[i] = image.str();
+			remaining[i]--;
+		});
+	}
+
+	fout.write((char *)& ARCHIVE_MAGIC, sizeof(int));
+
+	for (int i = 0; i < fileCount; i++) {
+
+		waitForPoolTasks(remaining[i]);
+
+		if (!compressed[i]) {
+
+			cout << "Unable to read " + fileNames[i] + ", skipping\n";
+			continue;
+		}
+
+		ArchiveEntry entry;
+
+		entry.name = getStoredName(fileNames[i]);
+		entry.offset = (long long)fout.tellp();
+		entry.originalLength = originalLengths[i];
+		entry.compressedLength = (int)images[i].size();
+
+		fout.write(images[i].data(), images[i].size());
+		string().swap(images[i]);
+
+		directory.push_back(entry);
+	}
+
+	long long directoryOffset = (long long)fout.tellp();
+	int entryCount = (int)directory.size();
+
+	for (int i = 0; i < (int)directory.size(); i++) {
+
+		int nameLength = (int)directory[i].name.size();
+
+		fout.write((char *)& nameLength, sizeof(int));
+		fout.write(directory[i].name.c_str(), nameLength);
+		fout.write((char *)& directory[i].originalLength, sizeof(int));
+		fout.write((char *)& directory[i].compressedLength, sizeof(int));
+		fout.write((char *)& directory[i].offset, sizeof(long long));
+	}
+
+	// Footer
+	fout.write((char *)& directoryOffset, sizeof(long long));
+	fout.write((char *)& entryCount, sizeof(int));
+	fout.write((char *)& ARCHIVE_MAGIC, sizeof(int));
+
+	fout.close();
+
+	return true;
+}
+
+/******************************************************************************
+	Name: sampleFile
+
+	Des:
+		Count the bytes of chunks spread evenly through a file, reading about
+		sampleFraction of it in all. Each chunk starts at a random point in
+		its stretch of the file so that data repeating at the same stride
+		is not sampled in the same place every time. Files too small to
+		skip anything are read whole
+
+	Params:
+		fileName - type const string &, the file to sample
+		fileSize - type long long, the size of the file
+		sampleFraction - type double, the fraction of the file to read
+		frequencyTable - type long long[], the table the counts are added to
+
+	Returns:
+		type long long, the number of bytes read
+******************************************************************************/
+long long sampleFile(const string &fileName, long long fileSize, double sampleFraction, long long frequencyTable[BYTE_GLYPHS]) {
+
+	ifstream fin(fileName, ios::in | ios::binary);
+
+	if (!fin.is_open() || fileSize == 0) {
+
+		return 0;
+	}
+
+	long long chunkCount = max(1LL, (long long)ceil(fileSize * sampleFraction / SAMPLE_CHUNK_SIZE));
+	long long stride = fileSize / chunkCount;
+
+	if (stride <= SAMPLE_CHUNK_SIZE) {
+
+		stride = SAMPLE_CHUNK_SIZE;
+		chunkCount = (fileSize + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+	}
+
+	vector<unsigned char> chunk(SAMPLE_CHUNK_SIZE);
+	long long sampledBytes = 0;
+
+	mt19937_64 random(fileSize);
+	uniform_int_distribution<long long> jitter(0, stride - SAMPLE_CHUNK_SIZE);
+
+	for (long long i = 0; i < chunkCount; i++) {
+
+		fin.seekg(i * stride + jitter(random));
+		fin.read((char *)chunk.data(), SAMPLE_CHUNK_SIZE);
+
+		int readLength = (int)fin.gcount();
+		int chunkFrequencies[MAX_GLYPHS] = { 0 };
+
+		countGlyphs(chunk.data(), readLength, chunkFrequencies);
+
+		for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+			frequencyTable[glyph] += chunkFrequencies[glyph];
+		}
+
+		sampledBytes += readLength;
+		fin.clear();
+	}
+
+	return sampledBytes;
+}
+
+/******************************************************************************
+	Name: estimateCompressedSize
+
+	Des:
+		Project the size huff would compress files to, from a sample of each
+		file, without writing anything. Each sample gets the length limited
+		table a block would, and its coded length is scaled up to the whole
+		file along with the table and header of every block. A file that
+		printOutput would store, judged by the same look at its first bytes,
+		is projected at its own size plus block headers. Directories are
+		searched with findInputFiles, so huf files in them are left out as
+		they are when compressing
+
+	Params:
+		paths - type vector<string> &, the files and directories to estimate
+		sampleFraction - type double, the fraction of each file to read
+		blockSize - type int, the block size the files would be written with
+		skipEntropy - type double, the entropy at which a file is stored
+		report - type ostream &, the stream the estimate is written to
+
+	Returns:
+		type bool, false if a file could not be read
+******************************************************************************/
+bool estimateCompressedSize(vector<string> &paths, double sampleFraction, int blockSize, double skipEntropy, ostream &report) {
+
+	vector<InputFile> inputFiles = findInputFiles(paths);
+	vector<string> fileNames;
+	error_code error;
+	bool readAll = true;
+
+	for (int i = 0; i < (int)inputFiles.size(); i++) {
+
+		fileNames.push_back(inputFiles[i].path);
+	}
+
+	long long fileCount = 0;
+	long long storedFiles = 0;
+
+	long long totalSize = 0;
+	long long totalSampled = 0;
+	double projectedSize = 0;
+	double entropyBits = 0;
+
+	for (int i = 0; i < (int)fileNames.size(); i++) {
+
+		long long fileSize = (long long)filesystem::file_size(fileNames[i], error);
+
+		if (error) {
+
+			cout << "Unable to read " << fileNames[i] << endl;
+			readAll = false;
+			error.clear();
+			continue;
+		}
+
+		fileCount++;
+
+		long long sampleFrequencies[BYTE_GLYPHS] = { 0 };
+		long long sampledBytes = sampleFile(fileNames[i], fileSize, sampleFraction, sampleFrequencies);
+
+		long long blockCount = (fileSize + blockSize - 1) / blockSize;
+
+		// Block file header and footer
+		projectedSize += (double)(3 * sizeof(int) + fileNames[i].size() + sizeof(int));
+
+		if (sampledBytes == 0) {
+
+			totalSize += fileSize;
+			continue;
+		}
+
+		vector<unsigned char> start(ENTROPY_SAMPLE_SIZE);
+		ifstream fin(fileNames[i], ios::in | ios::binary);
+
+		fin.read((char *)start.data(), ENTROPY_SAMPLE_SIZE);
+
+		bool stored = getSampleEntropy(start.data(), (int)fin.gcount()) >= skipEntropy;
+
+		// Scale the counts into an int table the way trainDictionary does
+		long long largestFrequency = *max_element(sampleFrequencies, sampleFrequencies + BYTE_GLYPHS);
+		long long scale = largestFrequency / (INT_MAX / MAX_GLYPHS) + 1;
+
+		int frequencyTable[MAX_GLYPHS] = { 0 };
+
+		for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+			frequencyTable[glyph] = (int)((sampleFrequencies[glyph] + scale - 1) / scale);
+		}
+
+		unsigned char codeLengths[MAX_GLYPHS];
+
+		generateCodeLengths(frequencyTable, codeLengths, MAX_BLOCK_CODE_LENGTH);
+
+		double sampleBits = 0;
+
+		for (int glyph = 0; glyph < BYTE_GLYPHS; glyph++) {
+
+			sampleBits += (double)sampleFrequencies[glyph] * codeLengths[glyph];
+
+			if (sampleFrequencies[glyph] > 0) {
+
+				double probability = (double)sampleFrequencies[glyph] / sampledBytes;
+
+				entropyBits -= (double)sampleFrequencies[glyph] * log2(probability) * fileSize / sampledBytes;
+			}
+		}
+
+		if (stored) {
+
+			projectedSize += (double)fileSize + blockCount * 4 * sizeof(int);
+			storedFiles++;
+		} else {
+
+			projectedSize += sampleBits / BYTE_SIZE * fileSize / sampledBytes;
+			projectedSize += (double)blockCount * (4 * sizeof(int) + getCompactCodeLengthsSize(codeLengths, BYTE_GLYPHS));
+		}
+
+		totalSize += fileSize;
+		totalSampled += sampledBytes;
+	}
+
+	report << "Files: " << fileCount << " (" << storedFiles << " would be stored without compressing)" << endl;
+	report << "Original size: " << totalSize << " bytes" << endl;
+	report << "Sampled: " << totalSampled << " bytes (" << fixed << setprecision(2) << (totalSize > 0 ? 100.0 * totalSampled / totalSize : 0.0) << "%)" << endl;
+	report << "Projected compressed size: " << setprecision(0) << projectedSize << " bytes" << endl;
+	report << "Projected ratio: " << setprecision(4) << (totalSize > 0 ? projectedSize / totalSize : 0.0) << endl;
+	report << "Entropy: " << setprecision(4) << (totalSize > 0 ? entropyBits / totalSize : 0.0) << " bits per byte" << endl;
+
+	return readAll;
+}
+
+/******************************************************************************
+	Name: resetAdaptiveTree
+
+	Des:
+		Reset an adaptive huffman tree to a lone NYT node at the root
+
+	Params:
+		tree - type AdaptiveHuffmanTree &, the adaptive huffman tree
+******************************************************************************/
+void resetAdaptiveTree(AdaptiveHuffmanTree &tree) {
+
+	for (int i = 0; i < ADAPTIVE_GLYPHS; i++) {
+
+		tree.leaves[i] = DEFAULT_NODE_POINTER;
+	}
+
+	tree.notYetTransmitted = ADAPTIVE_ROOT_NODE;
+	tree.nodes[ADAPTIVE_ROOT_NODE] = { DEFAULT_NODE_POINTER, 0, DEFAULT_NODE_POINTER, DEFAULT_NODE_POINTER, DEFAULT_NODE_POINTER };
+}
+
+/******************************************************************************
+	Name: swapAdaptiveNodes
+
+	Des:
+		Swap the subtrees at two node numbers. Parents keep pointing at the
+		same numbers, so only the children and leaves need fixing
+
+	Params:
+		tree - type AdaptiveHuffmanTree &, the adaptive huffman tree
+		first - type int, the first node number
+		second - type int, the second node number
+******************************************************************************/
+void swapAdaptiveNodes(AdaptiveHuffmanTree &tree, int first, int second) {
+
+	AdaptiveNode &a = tree.nodes[first];
+	AdaptiveNode &b = tree.nodes[second];
+
+	swap(a.glyph, b.glyph);
+	swap(a.weight, b.weight);
+	swap(a.left, b.left);
+	swap(a.right, b.right);
+
+	int numbers[2] = { first, second };
+
+	for (int i = 0; i < 2; i++) {
+
+		AdaptiveNode &node = tree.nodes[numbers[i]];
+
+		if (node.left != DEFAULT_NODE_POINTER) {
+
+			tree.nodes[node.left].parent = numbers[i];
+			tree.nodes[node.right].parent = numbers[i];
+		} else if (node.glyph != DEFAULT_NODE_POINTER) {
+
+			tree.leaves[node.glyph] = numbers[i];
+		}
+	}
+}
+
+/******************************************************************************
+	Name: updateAdaptiveTree
+
+	Des:
+		Add one occurrence of a glyph to the adaptive huffman tree using the
+		FGK update, splitting the NYT node if the glyph is new
+
+	Params:
+		tree - type AdaptiveHuffmanTree &, the adaptive huffman tree
+		glyph - type int, the glyph that was coded
+******************************************************************************/
+void updateAdaptiveTree(AdaptiveHuffmanTree &tree, int glyph) {
+
+	int current = tree.leaves[glyph];
+
+	if (current == DEFAULT_NODE_POINTER) {
+
+		// Split the NYT node into a new NYT node and a leaf for the glyph
+		int parent = tree.notYetTransmitted;
+		int newNotYetTransmitted = parent - 2;
+
+		current = parent - 1;
+
+		tree.nodes[parent].left = newNotYetTransmitted;
+		tree.nodes[parent].right = current;
+
+		tree.nodes[current] = { glyph, 0, parent, DEFAULT_NODE_POINTER, DEFAULT_NODE_POINTER };
+		tree.nodes[newNotYetTransmitted] = { DEFAULT_NODE_POINTER, 0, parent, DEFAULT_NODE_POINTER, DEFAULT_NODE_POINTER };
+
+		tree.leaves[glyph] = current;
+		tree.notYetTransmitted = newNotYetTransmitted;
+	}
+
+	while (current != DEFAULT_NODE_POINTER) {
+
+		// Find the highest numbered node of the same weight
+		int leader = current;
+
+		while (leader < ADAPTIVE_ROOT_NODE && tree.nodes[leader + 1].weight == tree.nodes[current].weight) {
+
+			leader++;
+		}
+
+		if (leader != current && leader != tree.nodes[current].parent) {
+
+			swapAdaptiveNodes(tree, current, leader);
+			current = leader;
+		}
+
+		tree.nodes[current].weight++;
+		current = tree.nodes[current].parent;
+	}
+}
+
+/******************************************************************************
+	Name: writeAdaptiveGlyph
+
+	Des:
+		Write the current code of a glyph. A new glyph is written as the code
+		of the NYT node followed by its 8 bits
+
+	Params:
+		tree - type AdaptiveHuffmanTree &, the adaptive huffman tree
+		glyph - type int, the glyph to write
+		writer - type BitWriter &, the bit writer
+******************************************************************************/
+void writeAdaptiveGlyph(AdaptiveHuffmanTree &tree, int glyph, BitWriter &writer) {
+
+	int node = tree.leaves[glyph];
+
+	if (node == DEFAULT_NODE_POINTER) {
+
+		node = tree.notYetTransmitted;
+	}
+
+	// Collect the path from the leaf up, then write it from the root down
+	char path[MAX_ADAPTIVE_NODES];
+	int pathLength = 0;
+
+	while (node != ADAPTIVE_ROOT_NODE) {
+
+		int parent = tree.nodes[node].parent;
+
+		path[pathLength++] = tree.nodes[parent].right == node;
+		node = parent;
+	}
+
+	while (pathLength > 0) {
+
+		writeBit(writer, path[--pathLength]);
+	}
+
+	if (tree.leaves[glyph] == DEFAULT_NODE_POINTER) {
+
+		for (int i = 0; i < BYTE_SIZE; i++) {
+
+			writeBit(writer, (glyph >> i) & 1);
+		}
+	}
+}
+
+/******************************************************************************
+	Name: readInputChunk
+
+	Des:
+		Read up to a chunk of input. Standard input returns as soon as any
+		data is available so a live stream is coded record by record
+
+	Params:
+		fin - type ifstream *, the input file, nullptr for standard input
+		buffer - type char *, the buffer to read into
+		bufferLength - type int, the size of the buffer
+
+	Returns:
+		type int, the number of bytes read, 0 at the end of the input
+******************************************************************************/
+int readInputChunk(ifstream *fin, char *buffer, int bufferLength) {
+
+	if (fin != nullptr) {
+
+		fin->read(buffer, bufferLength);
+
+		return (int)fin->gcount();
+	}
+
+#ifdef _WIN32
+	int bytesRead = _read(0, buffer, bufferLength);
+#else
+	int bytesRead = (int)read(STDIN_FILENO, buffer, bufferLength);
+#endif
+
+	return max(bytesRead, 0);
+}
+
+/******************************************************************************
+	Name: compressAdaptiveStream
+
+	Des:
+		Compress a file or standard input in a single pass with adaptive
+		huffman coding. Each chunk read becomes one block, coded with the
+		model left by the previous blocks, and is flushed straight away so
+		memory stays constant and latency is one chunk. A file name of "-"
+		reads standard input and writes standard output
+
+	Params:
+		fileName - type string &, the name of the file
+
+	Returns:
+		type bool, false if the input or output could not be opened
+******************************************************************************/
+bool compressAdaptiveStream(string &fileName) {
+
+	const string hufFileExtension = ".huf";
+	const bool standardStreams = fileName == "-";
+
+	ifstream fin;
+	ofstream fileOut;
+
+	if (!standardStreams) {
+
+		fin.open(fileName, ios::in | ios::binary);
+		fileOut.open(fileName.substr(0, fileName.find_last_of('.')) + hufFileExtension, ios::out | ios::binary);
+
+		if (!fin.is_open() || !fileOut.is_open()) {
+
+			return false;
+		}
+	}
+
+	ostream &fout = standardStreams ? cout : fileOut;
+
+	AdaptiveHuffmanTree *tree = new AdaptiveHuffmanTree;
+	char *chunk = new char[ADAPTIVE_CHUNK_SIZE];
+	BitWriter writer;
+
+	resetAdaptiveTree(*tree);
+
+	writeBlockFileHeader(fout, fileName);
+	fout.flush();
+
+	unsigned int fileCrc = CRC_INITIAL;
+	int chunkLength;
+
+	while ((chunkLength = readInputChunk(standardStreams ? nullptr : &fin, chunk, ADAPTIVE_CHUNK_SIZE)) > 0) {
+
+		if (tree->nodes[ADAPTIVE_ROOT_NODE].weight >= ADAPTIVE_RESET_WEIGHT) {
+
+			resetAdaptiveTree(*tree);
+		}
+
+		writer.bytes.clear();
+		writer.currentBit = BYTE_SIZE;
+
+		for (int i = 0; i < chunkLength; i++) {
+
+			unsigned char glyph = chunk[i];
+
+			writeAdaptiveGlyph(*tree, glyph, writer);
+			updateAdaptiveTree(*tree, glyph);
+		}
+
+		fileCrc = updateCrc(fileCrc, chunk, chunkLength);
+
+		writeBlockHeader(fout, BLOCK_ADAPTIVE, chunkLength, (int)writer.bytes.size(), ~updateCrc(CRC_INITIAL, chunk, chunkLength));
+		fout.write((char *)writer.bytes.data(), writer.bytes.size());
+		fout.flush();
+	}
+
+	writeBlockFileFooter(fout, ~fileCrc);
+	fout.flush();
+
+	delete tree;
+	delete[] chunk;
+
+	return true;
+}
+
+/******************************************************************************
+	Name: startCompressionStream
+
+	Des:
+		Start an incremental compressor. It writes the same block format as
+		a whole file, in blocks of the type getBlockType picks, and the file
+		header is ready to drain straight away. Dictionary, order-1 and LZ
+		blocks are each coded on their own, so LZ matches stay inside a
+		block
+
+	Params:
+		oStream - type CompressionStream &, the stream to start
+		fileName - type string &, the name Puff gives the output
+		options - type const CompressionOptions &, the block size and mode
+******************************************************************************/
+void startCompressionStream(CompressionStream &oStream, string &fileName, const CompressionOptions &options) {
+
+	VectorStreamBuffer outputBuffer(&oStream.output);
+	ostream out(&outputBuffer);
+
+	oStream.options = options;
+	oStream.blockType = getBlockType(options);
+
+	writeBlockFileHeader(out, fileName);
+}
+
+/******************************************************************************
+	Name: writeStreamBlocks
+
+	Des:
+		Code the first bytes waiting in a stream as blocks, carrying the last
+		huffman table on to the next call
+
+	Params:
+		stream - type CompressionStream &, the stream
+		dataLength - type int, the number of waiting bytes to code
+******************************************************************************/
+void writeStreamBlocks(CompressionStream &stream, int dataLength) {
+
+	VectorStreamBuffer outputBuffer(&stream.output);
+	ostream out(&outputBuffer);
+
+	writeBlocks(out, stream.input.data(), dataLength, stream.blockType, stream.options, &stream.carriedLengths);
+
+	stream.fileCrc = updateCrc(stream.fileCrc, stream.input.data(), dataLength);
+	stream.input.erase(stream.input.begin(), stream.input.begin() + dataLength);
+}
+
+/******************************************************************************
+	Name: feedCompressionStream
+
+	Des:
+		Add input to a stream, coding every whole block now waiting. The rest
+		waits for more input or a flush
+
+	Params:
+		stream - type CompressionStream &, the stream
+		data - type const char *, the input
+		dataLength - type int, the length of the input
+******************************************************************************/
+void feedCompressionStream(CompressionStream &stream, const char *data, int dataLength) {
+
+	const int blockSize = max(1, min(stream.options.blockSize, MAX_BLOCK_SIZE));
+
+	stream.input.insert(stream.input.end(), data, data + dataLength);
+
+	if ((int)stream.input.size() >= blockSize) {
+
+		writeStreamBlocks(stream, (int)(stream.input.size() / blockSize * blockSize));
+	}
+}
+
+/******************************************************************************
+	Name: flushCompressionStream
+
+	Des:
+		Code whatever input is waiting as a short block, so everything fed
+		so far can be decoded from the output drained so far
+
+	Params:
+		stream - type CompressionStream &, the stream
+******************************************************************************/
+void flushCompressionStream(CompressionStream &stream) {
+
+	if (!stream.input.empty()) {
+
+		writeStreamBlocks(stream, (int)stream.input.size());
+	}
+}
+
+/******************************************************************************
+	Name: finishCompressionStream
+
+	Des:
+		Flush a stream and write the end block and file checksum. Nothing can
+		be fed after this, but the output still needs draining
+
+	Params:
+		stream - type CompressionStream &, the stream
+******************************************************************************/
+void finishCompressionStream(CompressionStream &stream) {
+
+	flushCompressionStream(stream);
+
+	VectorStreamBuffer outputBuffer(&stream.output);
+	ostream out(&outputBuffer);
+
+	writeBlockFileFooter(out, ~stream.fileCrc);
+	stream.finished = true;
+}
+
+/******************************************************************************
+	Name: drainCompressionStream
+
+	Des:
+		Take up to a buffer of the output a stream has ready
+
+	Params:
+		stream - type CompressionStream &, the stream
+		buffer - type char *, the buffer to copy into
+		bufferLength - type int, the size of the buffer
+
+	Returns:
+		type int, the number of bytes copied, 0 once the output is drained
+******************************************************************************/
+int drainCompressionStream(CompressionStream &stream, char *buffer, int bufferLength) {
+
+	int length = (int)min((size_t)bufferLength, stream.output.size() - stream.drainedLength);
+
+	memcpy(buffer, stream.output.data() + stream.drainedLength, length);
+	stream.drainedLength += length;
+
+	// The buffer keeps its capacity for the next blocks
+	if (stream.drainedLength == stream.output.size()) {
+
+		stream.output.clear();
+		stream.drainedLength = 0;
+	}
+
+	return length;
+}
+
+/******************************************************************************
+	Name: compressStandardInput
+
+	Des:
+		Compress standard input to standard output through a compression
+		stream, writing each block as soon as it is coded
+
+	Params:
+		options - type const CompressionOptions &, the block size and mode
+
+	Returns:
+		type bool, false if the output could not be written
+******************************************************************************/
+bool compressStandardInput(const CompressionOptions &options) {
+
+	string streamName = "-";
+	CompressionStream stream;
+	char *chunk = new char[STREAM_CHUNK_SIZE];
+	int chunkLength;
+
+	startCompressionStream(stream, streamName, options);
+
+	do {
+
+		chunkLength = readInputChunk(nullptr, chunk, STREAM_CHUNK_SIZE);
+
+		if (chunkLength > 0) {
+
+			feedCompressionStream(stream, chunk, chunkLength);
+		} else {
+
+			finishCompressionStream(stream);
+		}
+
+		int drainedLength;
+
+		while ((drainedLength = drainCompressionStream(stream, chunk, STREAM_CHUNK_SIZE)) > 0) {
+
+			cout.write(chunk, drainedLength);
+		}
+
+		cout.flush();
+	} while (chunkLength > 0);
+
+	delete[] chunk;
+
+	return (bool)cout;
+}
+
+/******************************************************************************
+	Name: generateDictionaryId
+
+	Des:
+		Hash the code lengths of a dictionary into the ID stored in huf files
+		that use it
+
+	Params:
+		codeLengths - type unsigned char[MAX_GLYPHS], the code lengths
+
+	Returns:
+		type int, the dictionary ID
+******************************************************************************/
+int generateDictionaryId(const unsigned char codeLengths[MAX_GLYPHS]) {
+
+	unsigned int hash = FNV_OFFSET_BASIS;
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		hash ^= codeLengths[i];
+		hash *= FNV_PRIME;
+	}
+
+	return (int)hash;
+}
+
+/******************************************************************************
+	Name: trainDictionary
+
+	Des:
+		Build a shared huffman table from a sample corpus and save its code
+		lengths as a dictionary file. Every glyph is given a code so any
+		payload can be encoded against the dictionary
+
+	Params:
+		dictionaryName - type string &, the name of the dictionary file
+		sampleNames - type vector<string> &, the sample files
+
+	Returns:
+		type bool, false if the dictionary could not be written
+******************************************************************************/
+bool trainDictionary(string &dictionaryName, vector<string> &sampleNames) {
+
+	long long sampleFrequencies[MAX_GLYPHS] = { 0 };
+	long long largestFrequency = 0;
+
+	for (int i = 0; i < (int)sampleNames.size(); i++) {
+
+		int dataLength;
+
+		char *data = readFile(sampleNames[i], dataLength);
+
+		if (data == nullptr) {
+
+			cout << "Unable to read " << sampleNames[i] << ", skipping" << endl;
+			continue;
+		}
+
+		int dataFrequencies[MAX_GLYPHS] = { 0 };
+
+		countGlyphs((unsigned char *)data, dataLength, dataFrequencies);
+
+		for (int j = 0; j < BYTE_GLYPHS; j++) {
+
+			sampleFrequencies[j] += dataFrequencies[j];
+		}
+
+		// Each sample is one payload with its own EOF glyph
+		sampleFrequencies[EOF_GLYPH]++;
+
+		delete[] data;
+	}
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		largestFrequency = max(largestFrequency, sampleFrequencies[i]);
+	}
+
+	// Scale into the range of an int, keeping every glyph in the alphabet
+	long long scale = largestFrequency / (INT_MAX / 2) + 1;
+
+	int frequencyTable[MAX_GLYPHS];
+
+	for (int i = 0; i < MAX_GLYPHS; i++) {
+
+		frequencyTable[i] = (int)(sampleFrequencies[i] / scale) + 1;
+	}
+
+	Dictionary dictionary;
+
+	generateCodeLengths(frequencyTable, dictionary.codeLengths, MAX_CODE_LENGTH);
+
+	dictionary.id = generateDictionaryId(dictionary.codeLengths);
+
+	ofstream fout(dictionaryName, ios::out | ios::binary);
+
+	if (!fout.is_open()) {
+
+		return false;
+	}
+
+	fout.write((char *)& DICTIONARY_MAGIC, sizeof(int));
+	fout.write((char *)& dictionary.id, sizeof(int));
+	fout.write((char *)dictionary.codeLengths, MAX_GLYPHS);
+
+	fout.close();
+
+	cout << "Dictionary ID: " << hex << (unsigned int)dictionary.id << dec << endl;
+
+	return true;
+}
+
+/******************************************************************************
+	Name: readDictionary
+
+	Des:
+		Read a dictionary file written by trainDictionary
+
+	Params:
+		dictionaryName - type string &, the name of the dictionary file
+		oDictionary - type Dictionary &, the dictionary read
+
+	Returns:
+		type bool, false if the file is not a valid dictionary
+******************************************************************************/
+bool readDictionary(string &dictionaryName, Dictionary &oDictionary) {
+
+	ifstream fin(dictionaryName, ios::in | ios::binary);
+
+	int magic = 0;
+
+	fin.read((char *)& magic, sizeof(int));
+	fin.read((char *)& oDictionary.id, sizeof(int));
+	fin.read((char *)oDictionary.codeLengths, MAX_GLYPHS);
+
+	if (!fin || magic != DICTIONARY_MAGIC || oDictionary.id != generateDictionaryId(oDictionary.codeLengths)) {
+
+		return false;
+	}
+
+	generateCanonicalBitcodes(oDictionary.codeLengths, oDictionary.bitcodeArray);
+
+	return true;
+}
+
+#ifndef _WIN32
+// Set by the signal handler to stop --serve
+volatile sig_atomic_t stopServing = 0;
+
+/******************************************************************************
+	Name: requestStop
+
+	Des:
+		Signal handler that asks the daemon to stop once its poll returns
+
+	Params:
+		type int, the signal caught, left unnamed since every signal it
+			handles means stop
+******************************************************************************/
+void requestStop(int) {
+
+	stopServing = 1;
+}
+
+/******************************************************************************
+	Name: transferFully
+
+	Des:
+		Read or write exactly length bytes on a socket, carrying on after
+		short transfers and interrupted calls
+
+	Params:
+		socketDescriptor - type int, the connected socket
+		data - type char *, the bytes to read into or write
+		length - type size_t, how many bytes
+		isWrite - type bool, true to write, false to read
+
+	Returns:
+		type bool, false if the peer closed the socket or it failed
+******************************************************************************/
+bool transferFully(int socketDescriptor, char *data, size_t length, bool isWrite) {
+
+	while (length > 0) {
+
+		ssize_t transferred = isWrite ? send(socketDescriptor, data, length, 0) : recv(socketDescriptor, data, length, 0);
+
+		if (transferred < 0 && errno == EINTR) {
+
+			continue;
+		}
+
+		if (transferred <= 0) {
+
+			return false;
+		}
+
+		data += transferred;
+		length -= transferred;
+	}
+
+	return true;
+}
+
+/******************************************************************************
+	Name: recordLatency
+
+	Des:
+		Add one request's time to a latency histogram
+
+	Params:
+		histogram - type LatencyHistogram &, the histogram of the request type
+		microseconds - type long long, how long the request took
+******************************************************************************/
+void recordLatency(LatencyHistogram &histogram, long long microseconds) {
+
+	int bucket = 0;
+
+	while (bucket < LATENCY_BUCKETS - 1 && (1LL << bucket) <= microseconds) {
+
+		bucket++;
+	}
+
+	histogram.buckets[bucket]++;
+	histogram.requests++;
+	histogram.totalMicroseconds += microseconds;
+}
+
+/******************************************************************************
+	Name: printLatencyHistograms
+
+	Des:
+		Write the request count, mean latency and the non-empty buckets of
+		every request type that has been served
+
+	Params:
+		out - type ostream &, where to write them
+		histograms - type LatencyHistogram *, one histogram per request type
+******************************************************************************/
+void printLatencyHistograms(ostream &out, LatencyHistogram *histograms) {
+
+	for (int type = 0; type < REQUEST_TYPES; type++) {
+
+		long long requests = histograms[type].requests;
+
+		if (requests == 0) {
+
+			continue;
+		}
+
+		out << REQUEST_NAMES[type] << ": " << requests << " requests, mean " << histograms[type].totalMicroseconds / requests << " us" << endl;
+
+		for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+
+			if (histograms[type].buckets[bucket] > 0) {
+
+				out << "\t< " << (1LL << bucket) << " us: " << histograms[type].buckets[bucket] << endl;
+			}
+		}
+	}
+}
+
+/******************************************************************************
+	Name: serveRequests
+
+	Des:
+		Run as a daemon on a UNIX domain socket until SIGINT or SIGTERM. The
+		main thread polls the listening socket and every idle connection,
+		and each request that arrives becomes a task in the pool, which
+		reads it, compresses it into a buffer kept by the worker and writes
+		the response before handing the connection back to be polled. The
+		pool, CRC tables and kernels stay warm between requests, so a small
+		request costs microseconds instead of a process start. With one
+		thread the main thread runs the requests itself
+
+	Params:
+		socketPath - type string &, where to create the socket
+		options - type CompressionOptions &, the compression mode used for
+			every request
+
+	Returns:
+		type bool, false if the socket could not be created
+******************************************************************************/
+bool serveRequests(string &socketPath, CompressionOptions &options) {
+
+	sockaddr_un address = {};
+
+	address.sun_family = AF_UNIX;
+
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+
+		return false;
+	}
+
+	strcpy(address.sun_path, socketPath.c_str());
+
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	int wakePipe[2];
+
+	unlink(socketPath.c_str());
+
+	if (listenSocket < 0 || bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, SOMAXCONN) != 0 || pipe(wakePipe) != 0) {
+
+		return false;
+	}
+
+	// No SA_RESTART, so a signal interrupts poll
+	struct sigaction stopAction = {};
+
+	stopAction.sa_handler = requestStop;
+	sigaction(SIGINT, &stopAction, nullptr);
+	sigaction(SIGTERM, &stopAction, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	LatencyHistogram histograms[REQUEST_TYPES] = {};
+	vector<int> idleConnections;
+	vector<int> returnedConnections;
+	mutex returnLock;
+	atomic<int> busyConnections(0);
+
+	auto handleRequest = [&](int connection) {
+
+		thread_local vector<char> request;
+		thread_local vector<char> response;
+
+		int header[2] = { 0, 0 };
+		bool keepOpen = transferFully(connection, (char *)header, sizeof(header), false) && header[1] >= 0 && header[1] <= MAX_REQUEST_LENGTH;
+
+		if (keepOpen) {
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			int requestType = header[0] > 0 && header[0] < REQUEST_TYPES ? header[0] : 0;
+			int status = RESPONSE_OK;
+
+			request.resize(header[1]);
+			response.clear();
+			keepOpen = transferFully(connection, request.data(), request.size(), false);
+
+			VectorStreamBuffer responseBuffer(&response);
+			ostream responseOut(&responseBuffer);
+
+			if (requestType == REQUEST_COMPRESS) {
+
+				// The image is named "-" like a compressed stream, so Puff
+				// decodes it to standard output
+				string streamName = "-";
+
+				printOutput(responseOut, streamName, request.data(), (int)request.size(), options);
+			} else if (requestType == REQUEST_STATS) {
+
+				printLatencyHistograms(responseOut, histograms);
+			} else {
+
+				responseOut << "huff only serves compress and stats requests";
+				status = RESPONSE_ERROR;
+			}
+
+			int responseHeader[2] = { status, (int)response.size() };
+
+			keepOpen = keepOpen && transferFully(connection, (char *)responseHeader, sizeof(responseHeader), true) && transferFully(connection, response.data(), response.size(), true);
+
+			recordLatency(histograms[requestType], chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+		}
+
+		if (keepOpen) {
+
+			lock_guard<mutex> guard(returnLock);
+			returnedConnections.push_back(connection);
+		} else {
+
+			close(connection);
+		}
+
+		busyConnections--;
+
+		char wake = 0;
 
-	Params:
-		fileName - type string &, the name of the file
-		oDataLength - type int &, the length of the data
+		write(wakePipe[1], &wake, 1);
+	};
 
-	Returns:
-		type char *, the contents of the file
-******************************************************************************/
-char *readFile(string &fileName, int &oDataLength) {
+	while (!stopServing) {
 
-	char *result = nullptr;
+		vector<pollfd> pollDescriptors = { { listenSocket, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
 
-	ifstream fin;
-	fin.open(fileName, ios::in | ios::binary | ios::ate);
+		for (int i = 0; i < (int)idleConnections.size(); i++) {
 
-	if (fin.is_open()) {
+			pollDescriptors.push_back({ idleConnections[i], POLLIN, 0 });
+		}
 
-		oDataLength = (int)fin.tellg();
-		fin.seekg(ios::beg);
-		result = new char[oDataLength];
-		fin.read(result, (streamsize)oDataLength);
-	}
+		if (poll(pollDescriptors.data(), pollDescriptors.size(), -1) < 0) {
 
-	fin.close();
+			continue;
+		}
 
-	return result;
-}
+		vector<int> stillIdle;
 
-/******************************************************************************
-	Name: generateInitialHuffmanTable
+		for (int i = 2; i < (int)pollDescriptors.size(); i++) {
 
-	Des:
-		Builds the huffman table
+			if (pollDescriptors[i].revents == 0) {
 
-	Params:
-		data - type char *, the data for the huffman table
-		data - type int, the length of the data
+				stillIdle.push_back(pollDescriptors[i].fd);
+			} else {
 
-	Returns:
-		type vector<HuffmanNode>, the huffman table
-******************************************************************************/
-vector<HuffmanNode> generateInitialHuffmanTable(char *data, int dataLength) {
+				int connection = pollDescriptors[i].fd;
 
-	int frequencyTable[MAX_GLYPHS] = { 0 };
+				busyConnections++;
+				submitPoolTask([&handleRequest, connection]() { handleRequest(connection); });
+			}
+		}
 
-	for (int i = 0; i < dataLength; i++) {
+		idleConnections.swap(stillIdle);
 
-		unsigned char glyph = data[i];
+		if (pollDescriptors[1].revents != 0) {
 
-		frequencyTable[glyph]++;
-	}
+			char drain[256];
 
-	frequencyTable[EOF_GLYPH] = 1;
+			read(wakePipe[0], drain, sizeof(drain));
 
-	vector<HuffmanNode> result;
-	result.reserve(MAX_HUFFMAN_NODES);
+			lock_guard<mutex> guard(returnLock);
+			idleConnections.insert(idleConnections.end(), returnedConnections.begin(), returnedConnections.end());
+			returnedConnections.clear();
+		}
 
-	for (int i = 0; i < MAX_GLYPHS; i++) {
+		if (pollDescriptors[0].revents != 0) {
 
-		// If the glyph has a frequency greater than zero
-		if (frequencyTable[i] > 0) {
+			int connection = accept(listenSocket, nullptr, nullptr);
 
-			HuffmanNode node;
+			if (connection >= 0) {
 
-			node.glyph = i;
-			node.frequency = frequencyTable[i];
-			node.left = DEFAULT_NODE_POINTER;
-			node.right = DEFAULT_NODE_POINTER;
+				idleConnections.push_back(connection);
+			}
+		}
 
-			result.push_back(node);
+		if (taskPool.workers.empty()) {
+
+			while (runPoolTask()) {}
 		}
 	}
 
-	// Sort by frequency
-	sort(result.begin(), result.end(), [](HuffmanNode &a, HuffmanNode &b) {
+	// Requests already being served are finished before the daemon stops
+	waitForPoolTasks(busyConnections);
 
-		return a.frequency < b.frequency;
-		});
+	idleConnections.insert(idleConnections.end(), returnedConnections.begin(), returnedConnections.end());
 
-	return result;
+	for (int i = 0; i < (int)idleConnections.size(); i++) {
+
+		close(idleConnections[i]);
+	}
+
+	close(listenSocket);
+	close(wakePipe[0]);
+	close(wakePipe[1]);
+	unlink(socketPath.c_str());
+
+	printLatencyHistograms(cout, histograms);
+
+	return true;
 }
+#endif
 
 /******************************************************************************
-	Name: reheap
+	Name: applyCompressionLevel
 
 	Des:
-		Reheap the huffman table if necessary
+		Set the mode for a compression level. Level 1 builds block tables
+		from sampled histograms, 2 is plain block huffman, 3 to 8 an LZ
+		front end searching harder and further back and 9 the BWT stages.
+		Order-1 modeling has no level, since on most data it is both
+		slower and larger than the LZ levels
 
 	Params:
-		huffmanTable - type vector<HuffmanNode> &, the huffman table
-		reheapStartIndex - type int, the index where the reheap should start
-		topOfHeap - type int, top of the heap of unsorted nodes
+		oOptions - type CompressionOptions &, the options to set
+		level - type int, the level from MIN_LEVEL to MAX_LEVEL
 ******************************************************************************/
-void reheap(vector<HuffmanNode> &huffmanTable, int reheapStartIndex, int topOfHeap) {
+void applyCompressionLevel(CompressionOptions &oOptions, int level) {
 
-	const int leftNodeIndex = reheapStartIndex * 2 + 1;
-	const int rightNodeIndex = reheapStartIndex * 2 + 2;
+	oOptions.sampleHistogram = level == 1;
+	oOptions.splitBlocks = level != 1;
+	oOptions.order1 = false;
+	oOptions.lz = level >= MIN_LZ_LEVEL && level < MAX_LEVEL;
+	oOptions.bwt = level == MAX_LEVEL;
 
-	if (rightNodeIndex <= topOfHeap) {
+	if (oOptions.lz) {
 
-		// Either left or right is less than start
-		if (huffmanTable[leftNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency || huffmanTable[rightNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency) {
+		oOptions.lzEffort = LZ_LEVEL_EFFORTS[level - MIN_LZ_LEVEL];
+		oOptions.lzWindowBits = LZ_LEVEL_WINDOW_BITS[level - MIN_LZ_LEVEL];
+	}
+}
 
-			// Right is less than left
-			if (huffmanTable[rightNodeIndex].frequency < huffmanTable[leftNodeIndex].frequency) {
+/******************************************************************************
+	Usage:
+		huff [mode] [-j threads] [--fixed-blocks] [--output directory] [path...]
+		huff [mode] [-j threads] --archive archive path...
+		huff --append [mode] [--block-size bytes] [--output directory] path...
+		huff --train dictionary sample...
+		huff --adaptive file...
+		huff --estimate [--sample fraction] [--block-size bytes] [--skip-entropy bits] path...
+		huff [mode] [-j threads] --serve socket
+
+	where mode is one of
+		--level 1-9
+		--dictionary dictionary
+		--reference file [--lz-effort 1-9]
+		--order1
+		--lz [--lz-effort 1-9] [--lz-window 10-22]
+		--bwt [--block-size bytes]
+		--legacy
+
+	and any mode but --legacy and --reference takes [--skip-entropy bits]
+
+	Without a mode each block of up to --block-size bytes gets its own
+	huffman table, and --legacy writes the original single table format.
+	Blocks end where the statistics of the data change enough to pay for
+	a new table, and the report lists where each file was split, unless
+	--fixed-blocks asks for every block to be --block-size bytes. With no
+	files the program asks for the file to compress. A file of "-"
+	compresses standard input to standard output, through the adaptive
+	model with --adaptive and otherwise through a CompressionStream, which
+	writes a block in the selected mode as each --block-size bytes arrive.
+	--legacy and --reference need the whole file and can not be used
+	with "-".
+
+	--level picks a mode by speed: 1 builds each block's table from a
+	sample and reads the data once, 2 is the default, 3 to 8 are --lz with
+	more effort and a larger window and 9 is --bwt. Options after --level
+	override it.
+
+	--reference codes each file as an LZ delta against an earlier revision,
+	loading the revision into the match window first, so a revision costs
+	about as much as its changes. Puff needs the same file to decode it.
+	Matches reach back at most 4 MiB, the largest --lz-window, so a file
+	and its reference should fit in that together. huff warns when they
+	do not, since the start of the reference is then out of reach.
+
+	A file whose first 64 KiB have an order-0 entropy of at least
+	--skip-entropy bits per byte, 7.9 unless given, is stored in blocks
+	without coding. A threshold above 8 compresses every file.
+
+	--estimate projects the compressed size, ratio and entropy of files
+	and directories from a sample of each file, 1% unless --sample gives
+	another fraction, without writing any output.
+
+	Directories are compressed recursively, leaving out huf files. Each
+	huf file is written next to its input, or with --output under that
+	directory at the input's path below the directory named on the
+	command line. Inputs that would share a huf file, like foo.cpp and
+	foo.h, are not compressed. Whole files and the blocks inside them
+	share one pool of -j threads, one per core unless given. Huf files and
+	archives store each name relative, without a root or leading "..", so
+	Puff writes what it decodes below the directory it runs in.
+
+	--append brings existing block format huf files up to date with files
+	that have grown, such as logs, by adding blocks for the new bytes
+	only. The new blocks are coded in the selected mode, except that
+	--legacy and --reference can not be used with --append. A file with no
+	huf file yet is compressed in full.
+
+	--serve runs as a daemon on a UNIX domain socket until SIGINT or SIGTERM,
+	compressing each request with the given mode on a pool of -j threads
+	and printing request latency histograms when it stops. Requests and
+	responses are described with the REQUEST_ constants, and Puff --serve answers
+	decompress requests the same way.
+
+	--kernel portable|bmi2 forces the encoder kernel,
+	which is otherwise the best one the processor supports
+******************************************************************************/
+int main(int argc, char *argv[]) {
 
-				HuffmanNode tempNode = huffmanTable[rightNodeIndex];
+	string archiveName;
+	string trainName;
+	string dictionaryName;
+	string referenceName;
+	string socketPath;
+	bool estimateMode = false;
+	bool appendMode = false;
+	double sampleFraction = DEFAULT_SAMPLE_FRACTION;
+	string outputDirectory;
+	int threadCount = (int)thread::hardware_concurrency();
 
-				huffmanTable[rightNodeIndex] = huffmanTable[reheapStartIndex];
-				huffmanTable[reheapStartIndex] = tempNode;
-				reheap(huffmanTable, rightNodeIndex, topOfHeap);
-			// Left is less than or equal to right
-			} else {
+	detectCpuFeatures();
+	initializeCrc();
 
-				HuffmanNode tempNode = huffmanTable[leftNodeIndex];
+	bool adaptiveMode = false;
+	vector<string> fileNames;
+	CompressionOptions options;
+	CompressionStats stats;
 
-				huffmanTable[leftNodeIndex] = huffmanTable[reheapStartIndex];
-				huffmanTable[reheapStartIndex] = tempNode;
-				reheap(huffmanTable, leftNodeIndex, topOfHeap);
-			}
-		}
-	} else if (leftNodeIndex == topOfHeap) {
+	options.stats = &stats;
 
-		if (huffmanTable[leftNodeIndex].frequency < huffmanTable[reheapStartIndex].frequency) {
+	for (int i = 1; i < argc; i++) {
 
-			HuffmanNode tempNode = huffmanTable[leftNodeIndex];
+		string argument = argv[i];
 
-			huffmanTable[leftNodeIndex] = huffmanTable[reheapStartIndex];
-			huffmanTable[reheapStartIndex] = tempNode;
-			// Do not need to reheap final node
-		}
-	}
-}
+		if (argument == "--archive" && i + 1 < argc) {
 
-/******************************************************************************
-	Name: buildHuffmanTable
+			archiveName = argv[++i];
+		} else if (argument == "--train" && i + 1 < argc) {
 
-	Des:
-		Builds the huffman table
+			trainName = argv[++i];
+		} else if (argument == "--dictionary" && i + 1 < argc) {
 
-	Params:
-		huffmanTable - type vector<HuffmanNode> &, the huffman table
-		topOfHeap - type int, top of the heap of unsorted nodes
-******************************************************************************/
-void buildHuffmanTable(vector<HuffmanNode> &huffmanTable, int topOfHeap) {
+			dictionaryName = argv[++i];
+		} else if (argument == "--reference" && i + 1 < argc) {
 
-	int markedIndex;
+			referenceName = argv[++i];
+		} else if (argument == "--adaptive") {
 
-	if (topOfHeap != ROOT_NODE) {
+			adaptiveMode = true;
+		} else if (argument == "--serve" && i + 1 < argc) {
 
-		// Mark the lower frequency glyph at the second or third index
-		if (topOfHeap == SLOT_TWO_INDEX) {
+			socketPath = argv[++i];
+		} else if (argument == "--append") {
 
-			markedIndex = SLOT_TWO_INDEX;
-		} else {
+			appendMode = true;
+		} else if (argument == "--estimate") {
 
-			if (huffmanTable[SLOT_TWO_INDEX].frequency > huffmanTable[SLOT_THREE_INDEX].frequency) {
+			estimateMode = true;
+		} else if (argument == "--sample" && i + 1 < argc) {
 
-				markedIndex = SLOT_THREE_INDEX;
-			} else {
+			estimateMode = true;
+			sampleFraction = atof(argv[++i]);
 
-				markedIndex = SLOT_TWO_INDEX;
+			if (!(sampleFraction > 0 && sampleFraction <= 1)) {
+
+				cout << "The sample fraction must be greater than 0 and at most 1" << endl;
+				return EXIT_FAILURE;
 			}
-		}
+		} else if (argument == "--level" && i + 1 < argc) {
 
-		huffmanTable.push_back(huffmanTable[markedIndex]);
+			int level = atoi(argv[++i]);
 
-		if (topOfHeap != markedIndex) {
+			if (level < MIN_LEVEL || level > MAX_LEVEL) {
 
-			huffmanTable[markedIndex] = huffmanTable[topOfHeap];
-			reheap(huffmanTable, markedIndex, topOfHeap);
-		}
+				cout << "The level must be from " << MIN_LEVEL << " to " << MAX_LEVEL << endl;
+				return EXIT_FAILURE;
+			}
 
-		huffmanTable[topOfHeap] = huffmanTable[ROOT_NODE];
+			applyCompressionLevel(options, level);
+		} else if (argument == "--order1") {
 
-		// Create merge node
-		HuffmanNode node;
-		node.glyph = DEFAULT_NODE_POINTER;
-		node.frequency = huffmanTable[topOfHeap].frequency + huffmanTable[huffmanTable.size() - 1].frequency;
-		node.left = topOfHeap;
-		node.right = (int)huffmanTable.size() - 1;
+			options.order1 = true;
+		} else if (argument == "--lz") {
 
-		huffmanTable[ROOT_NODE] = node;
+			options.lz = true;
+		} else if (argument == "--lz-effort" && i + 1 < argc) {
 
-		reheap(huffmanTable, ROOT_NODE, topOfHeap - 1);
+			options.lz = true;
+			options.lzEffort = atoi(argv[++i]);
+		} else if (argument == "--lz-window" && i + 1 < argc) {
 
-		buildHuffmanTable(huffmanTable, topOfHeap - 1);
-	}
-}
+			options.lz = true;
+			options.lzWindowBits = atoi(argv[++i]);
+		} else if (argument == "--bwt") {
 
-/******************************************************************************
-	Name: generateBitcodes
+			options.bwt = true;
+		} else if (argument == "--fixed-blocks") {
 
-	Des:
-		Generate map of glyph bitcodes
+			options.splitBlocks = false;
+		} else if (argument == "--legacy") {
 
-	Params:
-		huffmanTable - type vector<HuffmanNode> &, the huffman table
-		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
-		bitcode - type string, the current bitcode
-		currentIndex - type int, the current node index
-		oCompressedDataLength - type int &, the length of the compressedData
-******************************************************************************/
-void generateBitcodes(vector<HuffmanNode> &huffmanTable, string bitcodeArray[MAX_GLYPHS], string bitcode, int currentIndex, int &oCompressedDataLength) {
+			options.legacy = true;
+		} else if (argument == "--block-size" && i + 1 < argc) {
 
-	HuffmanNode currentNode = huffmanTable[currentIndex];
+			options.blockSize = atoi(argv[++i]);
+		} else if (argument == "--skip-entropy" && i + 1 < argc) {
 
-	if (currentNode.left == DEFAULT_NODE_POINTER && currentNode.right == DEFAULT_NODE_POINTER) {
+			options.skipEntropy = atof(argv[++i]);
+		} else if (argument == "--output" && i + 1 < argc) {
 
-		bitcodeArray[currentNode.glyph] = bitcode;
-		oCompressedDataLength += (int)bitcode.size() * currentNode.frequency;
-	} else {
+			outputDirectory = argv[++i];
+		} else if (argument == "-j" && i + 1 < argc) {
 
-		if (currentNode.left != DEFAULT_NODE_POINTER) {
+			threadCount = atoi(argv[++i]);
+		} else if (argument == "--kernel" && i + 1 < argc) {
 
-			generateBitcodes(huffmanTable, bitcodeArray, bitcode + '0', currentNode.left, oCompressedDataLength);
-		}
+			string kernelName = argv[++i];
+			int forcedKernel = (int)(find(KERNEL_NAMES, KERNEL_NAMES + KERNEL_COUNT, kernelName) - KERNEL_NAMES);
 
-		if (currentNode.right != DEFAULT_NODE_POINTER) {
+			if (forcedKernel == KERNEL_COUNT || !isKernelSupported(forcedKernel)) {
 
-			generateBitcodes(huffmanTable, bitcodeArray, bitcode + '1', currentNode.right, oCompressedDataLength);
+				cout << "The " << kernelName << " kernel is not available on this processor" << endl;
+				return EXIT_FAILURE;
+			}
+
+			kernel = forcedKernel;
+		} else {
+
+			fileNames.push_back(argument);
 		}
 	}
-}
 
-/******************************************************************************
-	Name: compressData
+	if (fileNames.empty() && socketPath.empty()) {
 
-	Des:
-		Compress the data using bitcodes
+		string fileName;
 
-	Params:
-		bitcodeArray - type string[MAX_GLYPHS], the array of glyph bitcodes
-		data - type char *, the original data
-		dataLength - type int, the length of the original data
-		compressedDataLengthInBytes - type int, the length of the
-			compressedData in bytes
-	Returns:
-		type unsigned char*, the compressed data
-******************************************************************************/
-unsigned char *compressData(string bitcodeArray[MAX_GLYPHS], char *data, int dataLength, int compressedDataLengthInBytes) {
+		cout << "Enter the name of the file you want to compress: ";
 
-	unsigned char *compressedData = new unsigned char[compressedDataLengthInBytes] { 0 };
+		cin >> fileName;
 
-	int currentCompressedByte = 0;
-	int currentBit = 0;
+		fileNames.push_back(fileName);
+	}
 
-	// Encode right to left
-	for (int i = 0; i < dataLength; i++) {
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
 
-		const string &bitcode = bitcodeArray[(unsigned char)data[i]];
+	// Keep standard output clean when it carries a compressed stream
+	const bool standardInput = find(fileNames.begin(), fileNames.end(), "-") != fileNames.end();
+	ostream &report = standardInput ? cerr : cout;
 
-		const char *bitcodeChars = bitcode.c_str();
-		const size_t bitcodeSize = bitcode.size();
+	// Standard input is coded a block at a time as it arrives, which the
+	// single table format and delta coding can not do
+	if (standardInput && !adaptiveMode && (options.legacy || !referenceName.empty())) {
 
-		for (int j = 0; j < bitcodeSize; j++) {
+		report << "Unable to compress standard input with --legacy or --reference" << endl;
+		return EXIT_FAILURE;
+	}
 
-			if (currentBit >= sizeof(char) * BYTE_SIZE) {
+	if (appendMode && (options.legacy || !referenceName.empty())) {
 
-				currentBit = 0;
-				currentCompressedByte++;
-			}
+		cout << "Unable to append with --legacy or --reference" << endl;
+		return EXIT_FAILURE;
+	}
 
-			if (bitcodeChars[j] == '1') {
+	Dictionary dictionary;
 
-				unsigned char bit = 0b00000001 << currentBit;
-				compressedData[currentCompressedByte] |= bit;
-			} else {
+	if (!dictionaryName.empty()) {
 
-				// Do nothing
-			}
+		if (!readDictionary(dictionaryName, dictionary)) {
 
-			currentBit++;
+			cout << "Unable to read dictionary " << dictionaryName << endl;
+			return EXIT_FAILURE;
 		}
-	}
-
-	// Add EOF glyph
-	const string currentGlyphBitcode = bitcodeArray[EOF_GLYPH];
 
-	for (int j = 0; j < currentGlyphBitcode.size(); j++) {
+		options.dictionary = &dictionary;
+	}
 
-		if (currentBit >= sizeof(char) * BYTE_SIZE) {
+	ReferenceFile reference;
 
-			currentBit = 0;
-			currentCompressedByte++;
-		}
+	if (!referenceName.empty()) {
 
-		if (currentGlyphBitcode[j] == '1') {
+		int referenceLength = 0;
+		char *referenceData = readFile(referenceName, referenceLength);
 
-			unsigned char bit = 0b00000001 << currentBit;
-			compressedData[currentCompressedByte] |= bit;
-		} else {
+		if (referenceData == nullptr) {
 
-			// Do nothing
+			cout << "Unable to read reference " << referenceName << endl;
+			return EXIT_FAILURE;
 		}
 
-		currentBit++;
+		reference.data.assign(referenceData, referenceData + referenceLength);
+		reference.checksum = ~updateCrc(CRC_INITIAL, referenceData, referenceLength);
+		options.reference = &reference;
+
+		delete[] referenceData;
 	}
 
-	return compressedData;
-}
+	clock_t startTime = clock();
 
-/******************************************************************************
-	Name: printOutput
+	startTaskPool(max(1, threadCount));
 
-	Des:
-		Print the compressed data to a file
+	vector<InputFile> inputFiles = findInputFiles(fileNames);
 
-	Params:
-		fileName - type string &, the name of the file
-		huffmanTable - type vector<HuffmanNode> &, the huffman table
-		compressedData - type unsigned char *, the compressed data
-		compressedDataLengthInBytes - type int, the length of the
-			compressedData in bytes
-******************************************************************************/
-void printOutput(string &fileName, vector<HuffmanNode> &huffmanTable, unsigned char *compressedData, int compressedDataLengthInBytes) {
+	if (!socketPath.empty()) {
 
-	const string hufFileExtension = ".huf";
+#ifdef _WIN32
+		cout << "--serve needs UNIX domain sockets, which this build does not support" << endl;
+#else
+		if (!serveRequests(socketPath, options)) {
 
-	const string outputFileName = fileName.substr(0, fileName.find_last_of('.')) + hufFileExtension;
+			cout << "Unable to listen on " << socketPath << endl;
+		}
+#endif
+	} else if (!archiveName.empty()) {
 
-	ofstream fout(outputFileName, ios::out | ios::binary);
+		vector<string> entryNames;
 
-	if (fout.is_open()) {
+		for (int i = 0; i < (int)inputFiles.size(); i++) {
 
-		size_t originalFileNameLength = fileName.size();
-		size_t numberOfHuffmanEntries = huffmanTable.size();
+			entryNames.push_back(inputFiles[i].path);
+		}
 
-		fout.write((char *)& originalFileNameLength, sizeof(int));
-		fout.write((char *)fileName.c_str(), originalFileNameLength);
+		if (!writeArchive(archiveName, entryNames, options)) {
 
-		fout.write((char *)& numberOfHuffmanEntries, sizeof(int));
+			cout << "Unable to open " << archiveName << endl;
+		}
+	} else if (!trainName.empty()) {
 
-		for (int i = 0; i < huffmanTable.size(); i++) {
+		if (!trainDictionary(trainName, fileNames)) {
 
-			fout.write((char *)& huffmanTable[i].glyph, sizeof(int));
-			fout.write((char *)& huffmanTable[i].left, sizeof(int));
-			fout.write((char *)& huffmanTable[i].right, sizeof(int));
+			cout << "Unable to open " << trainName << endl;
 		}
+	} else if (estimateMode) {
 
-		fout.write((char *)compressedData, compressedDataLengthInBytes);
-	}
+		estimateCompressedSize(fileNames, sampleFraction, max(1, min(options.blockSize, MAX_BLOCK_SIZE)), options.skipEntropy, report);
+	} else if (adaptiveMode) {
 
-	fout.close();
-}
+		for (int i = 0; i < (int)fileNames.size(); i++) {
 
-int main() {
+			if (!compressAdaptiveStream(fileNames[i])) {
 
-	string fileName;
+				cerr << "Unable to compress " << fileNames[i] << endl;
+			}
+		}
+	} else {
 
-	cout << "Enter the name of the file you want to compress: ";
+		vector<string> outputFileNames = getHufFileNames(inputFiles, outputDirectory);
+		atomic<int> remainingFiles((int)inputFiles.size());
 
-	cin >> fileName;
+		for (int i = (int)inputFiles.size() - 1; i >= 0; i--) {
 
-	clock_t startTime = clock();
+			submitPoolTask([&, i]() {
 
-	int dataLength;
+				string &outputFileName = outputFileNames[i];
 
-	char *data = readFile(fileName, dataLength);
+				if (outputFileName.empty()) {
 
-	if (data != nullptr) {
+					remainingFiles--;
+					return;
+				}
 
-		vector<HuffmanNode> huffmanTable = generateInitialHuffmanTable(data, dataLength);
+				if (inputFiles[i].path == "-" ? !compressStandardInput(options) : appendMode ? !appendToHufFile(inputFiles[i].path, outputFileName, options) : !compressToHufFile(inputFiles[i].path, outputFileName, options)) {
 
-		buildHuffmanTable(huffmanTable, (int)huffmanTable.size() - 1);
+					cout << "Unable to compress " + inputFiles[i].path + "\n";
+				}
 
-		string bitcodeArray[MAX_GLYPHS];
+				remainingFiles--;
+			});
+		}
+
+		waitForPoolTasks(remainingFiles);
+	}
+
+	stopTaskPool();
 
-		int compressedDataLength = 0;
+	if (stats.skippedFiles > 0) {
 
-		generateBitcodes(huffmanTable, bitcodeArray, "", ROOT_NODE, compressedDataLength);
+		report << "Stored without compressing: " << stats.skippedBytes << " bytes in " << stats.skippedFiles << " files" << endl;
+	}
+
+	for (int i = 0; i < (int)stats.blockSplits.size(); i++) {
 
-		// Convert from bits to bytes
-		compressedDataLength = (int)ceil(compressedDataLength / (double)BYTE_SIZE);
+		report << "Blocks of " << stats.blockSplits[i].first << " split at";
 
-		unsigned char *compressedData = compressData(bitcodeArray, data, dataLength, compressedDataLength);
+		for (int j = 0; j < (int)stats.blockSplits[i].second.size(); j++) {
 
-		printOutput(fileName, huffmanTable, compressedData, compressedDataLength);
+			report << " " << stats.blockSplits[i].second[j];
+		}
 
-		delete[compressedDataLength] compressedData;
-		delete[dataLength] data;
+		report << endl;
 	}
 
 	clock_t endTime = clock();
 	double secondsTaken = ((double)endTime - (double)startTime) / CLOCKS_PER_SEC;
 
-	cout << "Time taken: " << fixed << setprecision(6) << secondsTaken << endl;
-}
\ No newline at end of file
+	report << "Time taken: " << fixed << setprecision(6) << secondsTaken << endl;
+}